@@ -3,7 +3,61 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "devices/timer.h"
 #include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Most sectors the worker merges into one transfer. */
+#define MERGE_MAX 128
+
+/* Ticks a read or write may wait under the deadline scheduler
+   before it is served ahead of the elevator order. */
+#define READ_EXPIRE (TIMER_FREQ / 20)
+#define WRITE_EXPIRE (TIMER_FREQ / 2)
+
+/* An I/O scheduler, which decides the order in which a queue's
+   requests are carried out. */
+struct block_scheduler
+  {
+    const char *name;
+
+    /* Adds R to Q. */
+    void (*add) (struct block_queue *q, struct block_request *r);
+
+    /* Removes and returns the request in nonempty Q to carry out
+       next. */
+    struct block_request *(*next) (struct block_queue *q);
+  };
+
+/* A queue of requests for one or more devices, served by a worker
+   thread started on the first submission, in the order SCHEDULER
+   chooses.  Each device starts out with a queue of its own, but a
+   driver may share one among devices that cannot transfer at the
+   same time anyway, such as the disks on one IDE channel. */
+struct block_queue
+  {
+    struct list_elem list_elem;         /* Element in all_queues. */
+    char name[16];                      /* Queue name, e.g. "ide0". */
+
+    struct lock lock;
+    struct condition ready;             /* Signaled when nonempty. */
+    struct list requests;               /* Pending block_requests. */
+    bool worker_started;
+    const struct block_scheduler *scheduler;
+    bool scheduler_fixed;               /* SCHEDULER named for a device? */
+    block_sector_t head;                /* Sector after last transfer. */
+    uint8_t *merge_buffer;              /* MERGE_MAX sectors, or null. */
+
+    /* Utilization.  The worker is busy from when it picks up a
+       request until it next finds the queue empty. */
+    unsigned long long transfer_cnt;    /* Device transfers done. */
+    int64_t create_ticks;               /* When the queue was created. */
+    int64_t busy_ticks;                 /* Length of past busy periods. */
+    int64_t busy_since;                 /* Start of current busy period. */
+    bool busy;
+  };
 
 /* A block device. */
 struct block
@@ -19,6 +73,14 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+    struct block_latency latency;       /* Request latency histograms. */
+
+    /* If non-null, this device is the sectors of PARENT starting
+       at START, and asynchronous requests go to PARENT's queue. */
+    struct block *parent;
+    block_sector_t start;
+
+    struct block_queue *queue;          /* Queue for requests, if no parent. */
   };
 
 /* List of all block devices. */
@@ -27,7 +89,27 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 /* The block block assigned to each Pintos role. */
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
+/* List of all request queues. */
+static struct list all_queues = LIST_INITIALIZER (all_queues);
+
+/* -iosched: I/O scheduler for each device named on the command
+   line, and for every other device. */
+#define DEVICE_SCHEDULER_MAX 8
+static struct
+  {
+    const char *device;
+    const struct block_scheduler *scheduler;
+  }
+device_schedulers[DEVICE_SCHEDULER_MAX];
+static size_t device_scheduler_cnt;
+static const struct block_scheduler *default_scheduler;
+#define DEFAULT_SCHEDULER "deadline"
+
 static struct block *list_elem_to_block (struct list_elem *);
+static thread_func block_worker;
+static const struct block_scheduler *scheduler_for (const char *name);
+static void queue_adopt_scheduler (struct block_queue *, const char *name);
+static void queue_destroy (struct block_queue *);
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +202,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  block_read_multiple (block, sector, 1, buffer);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +213,470 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  block_write_multiple (block, sector, 1, buffer);
+}
+
+/* Reads CNT consecutive sectors starting at SECTOR from BLOCK
+   into BUFFER, which must have room for CNT * BLOCK_SECTOR_SIZE
+   bytes.  The request goes through BLOCK's queue like any other,
+   so the I/O scheduler can order it among them. */
+void
+block_read_multiple (struct block *block, block_sector_t sector,
+                     size_t cnt, void *buffer)
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&r, BLOCK_READ, sector, cnt, buffer, NULL, NULL);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Writes CNT consecutive sectors starting at SECTOR to BLOCK from
+   BUFFER, which must contain CNT * BLOCK_SECTOR_SIZE bytes, and
+   waits for the device to acknowledge them. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *buffer)
+{
+  struct block_request r;
+
+  if (cnt == 0)
+    return;
+  block_request_init (&r, BLOCK_WRITE, sector, cnt, (void *) buffer,
+                      NULL, NULL);
+  block_submit (block, &r);
+  block_wait (&r);
+}
+
+/* Initializes R to transfer CNT sectors starting at SECTOR
+   between a device and BUFFER, in the direction given by OP.
+   When R completes, DONE is called with R if it is non-null;
+   otherwise block_wait() returns. */
+void
+block_request_init (struct block_request *r, enum block_op op,
+                    block_sector_t sector, size_t cnt, void *buffer,
+                    block_done_func *done, void *aux)
+{
+  ASSERT (cnt > 0);
+
+  r->op = op;
+  r->sector = sector;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  r->done = done;
+  r->aux = aux;
+  sema_init (&r->complete, 0);
+}
+
+/* Queues R for BLOCK and returns without waiting for it.  R is
+   carried out later by the worker thread of BLOCK's queue, in the
+   order chosen by the queue's I/O scheduler.  A request for a
+   partition is redirected to the queue of the underlying disk. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  struct block_queue *q;
+
+  check_sector (block, r->sector);
+  check_sector (block, r->sector + r->cnt - 1);
+  ASSERT (r->op == BLOCK_READ || block->type != BLOCK_FOREIGN);
+
+  r->origin = block;
+  while (block->parent != NULL)
+    {
+      if (r->op == BLOCK_READ)
+        block->read_cnt += r->cnt;
+      else
+        block->write_cnt += r->cnt;
+      r->sector += block->start;
+      block = block->parent;
+    }
+
+  r->submit_usecs = timer_usecs ();
+  r->block = block;
+  r->deadline = timer_ticks () + (r->op == BLOCK_READ
+                                  ? READ_EXPIRE : WRITE_EXPIRE);
+
+  q = block->queue;
+  lock_acquire (&q->lock);
+  if (!q->worker_started)
+    {
+      char name[sizeof q->name + 3];
+
+      snprintf (name, sizeof name, "%s-io", q->name);
+      if (thread_create (name, PRI_DEFAULT, block_worker, q) == TID_ERROR)
+        PANIC ("%s: failed to start I/O worker", q->name);
+      q->worker_started = true;
+    }
+  q->scheduler->add (q, r);
+  cond_signal (&q->ready, &q->lock);
+  lock_release (&q->lock);
+}
+
+/* Waits for R, which must have been submitted without a
+   completion callback, to complete. */
+void
+block_wait (struct block_request *r)
+{
+  ASSERT (r->done == NULL);
+  sema_down (&r->complete);
+}
+
+/* Performs the transfer of CNT sectors starting at SECTOR
+   between BLOCK and BUFFER with BLOCK's driver. */
+static void
+device_transfer (struct block *block, enum block_op op,
+                 block_sector_t sector, size_t cnt, uint8_t *buffer)
+{
+  const struct block_operations *ops = block->ops;
+  size_t i;
+
+  if (op == BLOCK_READ)
+    {
+      if (ops->read_multiple != NULL)
+        ops->read_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          ops->read (block->aux, sector + i, buffer + i * BLOCK_SECTOR_SIZE);
+      block->read_cnt += cnt;
+    }
+  else
+    {
+      if (ops->write_multiple != NULL)
+        ops->write_multiple (block->aux, sector, cnt, buffer);
+      else
+        for (i = 0; i < cnt; i++)
+          ops->write (block->aux, sector + i,
+                      buffer + i * BLOCK_SECTOR_SIZE);
+      block->write_cnt += cnt;
+    }
+}
+
+/* Moves from Q to BATCH, which holds R, every queued request
+   that continues R on the same device in the same direction, so
+   that they can all be carried out as one transfer of at most
+   MERGE_MAX sectors.  Returns the total number of sectors in
+   BATCH.  Must be called with Q's lock held. */
+static size_t
+merge_requests (struct block_queue *q, struct block_request *r,
+                struct list *batch)
+{
+  block_sector_t end = r->sector + r->cnt;
+  size_t cnt = r->cnt;
+  struct list_elem *e;
+
+  list_push_back (batch, &r->elem);
+  if (q->merge_buffer == NULL)
+    return cnt;
+
+  e = list_begin (&q->requests);
+  while (e != list_end (&q->requests))
+    {
+      struct block_request *next = list_entry (e, struct block_request,
+                                               elem);
+
+      if (next->block == r->block && next->op == r->op
+          && next->sector == end && cnt + next->cnt <= MERGE_MAX)
+        {
+          list_remove (e);
+          list_push_back (batch, e);
+          end += next->cnt;
+          cnt += next->cnt;
+
+          /* The queue may hold the next one anywhere. */
+          e = list_begin (&q->requests);
+        }
+      else
+        e = list_next (e);
+    }
+  return cnt;
+}
+
+/* Adds a request of type OP that took USECS microseconds to
+   BLOCK's latency histograms. */
+static void
+record_latency (struct block *block, enum block_op op, uint64_t usecs)
+{
+  int op_idx = op == BLOCK_READ ? BLOCK_LATENCY_READ : BLOCK_LATENCY_WRITE;
+  int bucket = 0;
+
+  while (bucket < BLOCK_LATENCY_BUCKETS - 1 && (usecs >> (bucket + 1)) != 0)
+    bucket++;
+  block->latency.buckets[op_idx][bucket]++;
+  block->latency.total_us[op_idx] += usecs;
+}
+
+/* Signals completion of R, first recording its latency for the
+   device it was submitted to and each device under that. */
+static void
+complete_request (struct block_request *r)
+{
+  uint64_t usecs = timer_usecs () - r->submit_usecs;
+  struct block *block;
+
+  for (block = r->origin; block != NULL; block = block->parent)
+    record_latency (block, r->op, usecs);
+
+  if (r->done != NULL)
+    r->done (r);
+  else
+    sema_up (&r->complete);
+}
+
+/* Worker thread for queue Q_: carries out queued requests one at
+   a time, in the order chosen by the queue's I/O scheduler.
+   Requests for adjacent sectors are merged into a single
+   transfer through a bounce buffer. */
+static void
+block_worker (void *q_)
+{
+  struct block_queue *q = q_;
+
+  q->merge_buffer = palloc_get_multiple (0, MERGE_MAX
+                                         * BLOCK_SECTOR_SIZE / PGSIZE);
+  for (;;)
+    {
+      struct block_request *r;
+      struct block *block;
+      struct list batch;
+      struct list_elem *e;
+      size_t cnt;
+      uint8_t *p;
+
+      lock_acquire (&q->lock);
+      if (list_empty (&q->requests) && q->busy)
+        {
+          q->busy_ticks += timer_elapsed (q->busy_since);
+          q->busy = false;
+        }
+      while (list_empty (&q->requests))
+        cond_wait (&q->ready, &q->lock);
+      if (!q->busy)
+        {
+          q->busy_since = timer_ticks ();
+          q->busy = true;
+        }
+      r = q->scheduler->next (q);
+      list_init (&batch);
+      cnt = merge_requests (q, r, &batch);
+      q->head = r->sector + cnt;
+      q->transfer_cnt++;
+      lock_release (&q->lock);
+
+      block = r->block;
+      if (cnt == r->cnt)
+        {
+          device_transfer (block, r->op, r->sector, r->cnt, r->buffer);
+          complete_request (r);
+          continue;
+        }
+
+      if (r->op == BLOCK_WRITE)
+        for (e = list_begin (&batch), p = q->merge_buffer;
+             e != list_end (&batch); e = list_next (e))
+          {
+            struct block_request *w = list_entry (e, struct block_request,
+                                                  elem);
+            memcpy (p, w->buffer, w->cnt * BLOCK_SECTOR_SIZE);
+            p += w->cnt * BLOCK_SECTOR_SIZE;
+          }
+      device_transfer (block, r->op, r->sector, cnt, q->merge_buffer);
+      p = q->merge_buffer;
+      while (!list_empty (&batch))
+        {
+          struct block_request *done = list_entry (list_pop_front (&batch),
+                                                   struct block_request,
+                                                   elem);
+          if (done->op == BLOCK_READ)
+            memcpy (done->buffer, p, done->cnt * BLOCK_SECTOR_SIZE);
+          p += done->cnt * BLOCK_SECTOR_SIZE;
+          complete_request (done);
+        }
+    }
+}
+
+/* I/O schedulers.  Each keeps a queue's pending requests in its
+   own order and picks the next one to carry out.  Both functions
+   are called with the queue's lock held. */
+
+/* Returns true if request A_ starts before request B_. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+  return a->sector < b->sector;
+}
+
+/* "noop": First come, first served. */
+static void
+noop_add (struct block_queue *q, struct block_request *r)
+{
+  list_push_back (&q->requests, &r->elem);
+}
+
+static struct block_request *
+noop_next (struct block_queue *q)
+{
+  return list_entry (list_pop_front (&q->requests),
+                     struct block_request, elem);
+}
+
+/* "clook": Circular LOOK elevator.  The queue is kept sorted by
+   sector, and the head sweeps upward through it, serving the
+   first request at or beyond its position and then jumping back
+   to the lowest one. */
+static void
+clook_add (struct block_queue *q, struct block_request *r)
+{
+  list_insert_ordered (&q->requests, &r->elem, request_less, NULL);
+}
+
+static struct block_request *
+clook_next (struct block_queue *q)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&q->requests); e != list_end (&q->requests);
+       e = list_next (e))
+    if (list_entry (e, struct block_request, elem)->sector >= q->head)
+      break;
+  if (e == list_end (&q->requests))
+    e = list_begin (&q->requests);
+  list_remove (e);
+  return list_entry (e, struct block_request, elem);
+}
+
+/* "deadline": C-LOOK, except that a request that has waited past
+   its deadline (READ_EXPIRE or WRITE_EXPIRE ticks) is served
+   first, so that a busy region of the disk cannot starve the
+   rest. */
+static struct block_request *
+deadline_next (struct block_queue *q)
+{
+  struct block_request *oldest = NULL;
+  struct list_elem *e;
+
+  for (e = list_begin (&q->requests); e != list_end (&q->requests);
+       e = list_next (e))
+    {
+      struct block_request *r = list_entry (e, struct block_request, elem);
+      if (oldest == NULL || r->deadline < oldest->deadline)
+        oldest = r;
+    }
+
+  if (oldest->deadline <= timer_ticks ())
+    {
+      list_remove (&oldest->elem);
+      return oldest;
+    }
+  return clook_next (q);
+}
+
+static const struct block_scheduler schedulers[] =
+  {
+    {"noop", noop_add, noop_next},
+    {"clook", clook_add, clook_next},
+    {"deadline", clook_add, deadline_next},
+  };
+#define SCHEDULER_CNT (sizeof schedulers / sizeof *schedulers)
+
+/* Returns the I/O scheduler named NAME, or a null pointer if
+   there is none. */
+static const struct block_scheduler *
+find_scheduler (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < SCHEDULER_CNT; i++)
+    if (!strcmp (schedulers[i].name, name))
+      return &schedulers[i];
+  return NULL;
+}
+
+/* Configures I/O schedulers from SPEC, the value of the -iosched
+   option: a comma-separated list of entries, each either
+   DEV:SCHED to use SCHED for the device named DEV or just SCHED
+   to make it the default for other devices.  DEV may also name a
+   queue, such as IDE channel ide0; a device that shares a queue
+   sets the scheduler for everything on it.  Must be called
+   before the devices are registered.  Modifies SPEC.  Returns
+   false if SPEC names an unknown scheduler or has too many
+   entries. */
+bool
+block_configure_schedulers (char *spec)
+{
+  char *entry, *save_ptr;
+
+  for (entry = strtok_r (spec, ",", &save_ptr); entry != NULL;
+       entry = strtok_r (NULL, ",", &save_ptr))
+    {
+      char *colon = strchr (entry, ':');
+      const char *name = colon != NULL ? colon + 1 : entry;
+      const struct block_scheduler *scheduler = find_scheduler (name);
+
+      if (scheduler == NULL)
+        return false;
+      if (colon == NULL)
+        default_scheduler = scheduler;
+      else
+        {
+          if (device_scheduler_cnt >= DEVICE_SCHEDULER_MAX)
+            return false;
+          *colon = '\0';
+          device_schedulers[device_scheduler_cnt].device = entry;
+          device_schedulers[device_scheduler_cnt].scheduler = scheduler;
+          device_scheduler_cnt++;
+        }
+    }
+  return true;
+}
+
+/* Returns the I/O scheduler named for the device or queue NAME
+   on the command line, or a null pointer if there is none. */
+static const struct block_scheduler *
+named_scheduler (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < device_scheduler_cnt; i++)
+    if (!strcmp (device_schedulers[i].device, name))
+      return device_schedulers[i].scheduler;
+  return NULL;
+}
+
+/* Returns the I/O scheduler configured for the device or queue
+   named NAME. */
+static const struct block_scheduler *
+scheduler_for (const char *name)
+{
+  const struct block_scheduler *scheduler = named_scheduler (name);
+
+  if (scheduler != NULL)
+    return scheduler;
+  return (default_scheduler != NULL ? default_scheduler
+          : find_scheduler (DEFAULT_SCHEDULER));
+}
+
+/* Makes Q, which the device named NAME is about to share, use the
+   scheduler named for that device, if any, so that naming a disk
+   or partition orders the queue it actually uses.  Panics if
+   devices sharing Q were given different schedulers. */
+static void
+queue_adopt_scheduler (struct block_queue *q, const char *name)
+{
+  const struct block_scheduler *scheduler = named_scheduler (name);
+
+  if (scheduler == NULL)
+    return;
+  if (q->scheduler_fixed && q->scheduler != scheduler)
+    PANIC ("%s: conflicting I/O schedulers for shared queue %s",
+           name, q->name);
+  q->scheduler = scheduler;
+  q->scheduler_fixed = true;
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,10 +700,36 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Prints BLOCK's latency histogram for requests of type OP, if
+   there were any. */
+static void
+print_latency (struct block *block, int op)
+{
+  const struct block_latency *l = &block->latency;
+  unsigned long long cnt = block_latency_count (l, op);
+  int i;
+
+  if (cnt == 0)
+    return;
+
+  printf ("%s (%s): %s latency %llu us mean, p50 <= %llu us, "
+          "p99 <= %llu us\n",
+          block->name, block_type_name (block->type),
+          op == BLOCK_LATENCY_READ ? "read" : "write",
+          l->total_us[op] / cnt, block_latency_percentile (l, op, 50),
+          block_latency_percentile (l, op, 99));
+  for (i = 0; i < BLOCK_LATENCY_BUCKETS; i++)
+    if (l->buckets[op][i] != 0)
+      printf ("  %8llu us: %llu\n", 2ULL << i, l->buckets[op][i]);
+}
+
+/* Prints statistics for each block device used for a Pintos role,
+   including latency histograms, and the utilization of each
+   request queue that has been used. */
 void
 block_print_stats (void)
 {
+  struct list_elem *e;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
@@ -174,8 +740,45 @@ block_print_stats (void)
           printf ("%s (%s): %llu reads, %llu writes\n",
                   block->name, block_type_name (block->type),
                   block->read_cnt, block->write_cnt);
+          print_latency (block, BLOCK_LATENCY_READ);
+          print_latency (block, BLOCK_LATENCY_WRITE);
         }
     }
+
+  for (e = list_begin (&all_queues); e != list_end (&all_queues);
+       e = list_next (e))
+    {
+      struct block_queue *q = list_entry (e, struct block_queue, list_elem);
+      int64_t busy, elapsed;
+
+      if (q->transfer_cnt == 0)
+        continue;
+
+      lock_acquire (&q->lock);
+      busy = q->busy_ticks + (q->busy ? timer_elapsed (q->busy_since) : 0);
+      elapsed = timer_elapsed (q->create_ticks);
+      lock_release (&q->lock);
+      printf ("%s (queue): %llu transfers, busy %"PRId64" of %"PRId64
+              " ticks (%"PRId64"%%)\n", q->name, q->transfer_cnt, busy,
+              elapsed, elapsed > 0 ? busy * 100 / elapsed : 0);
+    }
+}
+
+/* Copies the latency histograms of the block device named NAME,
+   or of the file system device if NAME is null, into LATENCY.
+   Returns false if there is no such device.  The copy is not
+   synchronized with requests completing meanwhile, so counts may
+   be slightly inconsistent. */
+bool
+block_get_latency (const char *name, struct block_latency *latency)
+{
+  struct block *block = (name != NULL ? block_get_by_name (name)
+                         : block_get_role (BLOCK_FILESYS));
+  if (block == NULL)
+    return false;
+
+  *latency = block->latency;
+  return true;
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -200,6 +803,10 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  memset (&block->latency, 0, sizeof block->latency);
+  block->parent = NULL;
+  block->start = 0;
+  block->queue = block_queue_create (name);
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -211,6 +818,76 @@ block_register (const char *name, enum block_type type,
   return block;
 }
 
+/* Records that BLOCK consists of the sectors of PARENT starting
+   at START, so that asynchronous requests for BLOCK can be
+   queued with those for the rest of PARENT. */
+void
+block_set_parent (struct block *block, struct block *parent,
+                  block_sector_t start)
+{
+  ASSERT (start + block->size <= parent->size);
+
+  block->parent = parent;
+  block->start = start;
+  queue_destroy (block->queue);
+  block->queue = NULL;
+
+  while (parent->parent != NULL)
+    parent = parent->parent;
+  queue_adopt_scheduler (parent->queue, block->name);
+}
+
+/* Creates and returns a new, empty request queue named NAME,
+   whose I/O scheduler is the one configured for NAME. */
+struct block_queue *
+block_queue_create (const char *name)
+{
+  struct block_queue *q = malloc (sizeof *q);
+  if (q == NULL)
+    PANIC ("Failed to allocate memory for block request queue");
+
+  list_push_back (&all_queues, &q->list_elem);
+  strlcpy (q->name, name, sizeof q->name);
+  lock_init (&q->lock);
+  cond_init (&q->ready);
+  list_init (&q->requests);
+  q->worker_started = false;
+  q->scheduler = scheduler_for (name);
+  q->scheduler_fixed = false;
+  q->head = 0;
+  q->merge_buffer = NULL;
+  q->transfer_cnt = 0;
+  q->create_ticks = timer_ticks ();
+  q->busy_ticks = 0;
+  q->busy = false;
+  return q;
+}
+
+/* Frees Q, which must never have been used. */
+static void
+queue_destroy (struct block_queue *q)
+{
+  ASSERT (!q->worker_started);
+
+  list_remove (&q->list_elem);
+  free (q);
+}
+
+/* Makes BLOCK, which must not have been used yet, submit its
+   requests to Q, which may be shared with other devices. */
+void
+block_set_queue (struct block *block, struct block_queue *q)
+{
+  ASSERT (block->parent == NULL);
+
+  if (block->queue != q)
+    {
+      queue_destroy (block->queue);
+      block->queue = q;
+      queue_adopt_scheduler (q, block->name);
+    }
+}
+
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
 static struct block *
@@ -1,8 +1,12 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <block-latency.h>
+#include <list.h>
+#include "threads/synch.h"
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,11 +57,59 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous requests. */
+
+/* Operation performed by a block_request. */
+enum block_op
+  {
+    BLOCK_READ,                 /* Read from device into buffer. */
+    BLOCK_WRITE                 /* Write buffer to device. */
+  };
+
+struct block_request;
+
+/* Called in the device's worker thread when a request that named
+   it completes.  May resubmit or free the request. */
+typedef void block_done_func (struct block_request *);
+
+/* An asynchronous transfer of CNT consecutive sectors.  The
+   submitter owns the request and its buffer, which must stay
+   valid until it completes. */
+struct block_request
+  {
+    struct list_elem elem;      /* Element in a request queue. */
+    struct block *block;        /* Device, set by block_submit(). */
+    struct block *origin;       /* Device as submitted, e.g. a partition. */
+    enum block_op op;           /* Read or write. */
+    block_sector_t sector;      /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    void *buffer;               /* CNT * BLOCK_SECTOR_SIZE bytes. */
+    block_done_func *done;      /* Completion callback, or null. */
+    void *aux;                  /* For DONE's use. */
+    struct semaphore complete;  /* Up'd on completion if DONE is null. */
+    int64_t deadline;           /* Tick by which it should be served. */
+    uint64_t submit_usecs;      /* When it was submitted. */
+  };
+
+void block_request_init (struct block_request *, enum block_op,
+                         block_sector_t, size_t cnt, void *buffer,
+                         block_done_func *, void *aux);
+void block_submit (struct block *, struct block_request *);
+void block_wait (struct block_request *);
+
+/* I/O scheduling. */
+bool block_configure_schedulers (char *spec);
+
 /* Statistics. */
 void block_print_stats (void);
+bool block_get_latency (const char *name, struct block_latency *);
 
 /* Lower-level interface to block device drivers. */
 
@@ -65,10 +117,24 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional: transfer CNT consecutive sectors at once.  If
+       null, block_read_multiple() and block_write_multiple() fall
+       back to one read or write call per sector. */
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffer);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffer);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_set_parent (struct block *, struct block *parent,
+                       block_sector_t start);
+
+struct block_queue;
+struct block_queue *block_queue_create (const char *name);
+void block_set_queue (struct block *, struct block_queue *);
 
 #endif /* devices/block.h */
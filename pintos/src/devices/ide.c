@@ -3,12 +3,15 @@
 #include <debug.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
 #include "devices/block.h"
 #include "devices/partition.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -30,10 +33,25 @@
 #define reg_ctl(CHANNEL) ((CHANNEL)->reg_base + 0x206)  /* Control (w/o). */
 #define reg_alt_status(CHANNEL) reg_ctl (CHANNEL)       /* Alt Status (r/o). */
 
+/* Bus master IDE port addresses, relative to the channel's
+   base in the controller's PCI I/O space. */
+#define reg_bm_command(CHANNEL) ((CHANNEL)->bm_base + 0) /* Command. */
+#define reg_bm_status(CHANNEL) ((CHANNEL)->bm_base + 2)  /* Status. */
+#define reg_bm_prdt(CHANNEL) ((CHANNEL)->bm_base + 4)    /* PRD table. */
+
 /* Alternate Status Register bits. */
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
+
+/* Bus Master Command Register bits. */
+#define BM_CMD_START 0x01       /* Start transfer. */
+#define BM_CMD_READ 0x08        /* Transfer from disk to memory. */
+
+/* Bus Master Status Register bits. */
+#define BM_STA_ERROR 0x02       /* Transfer failed (write 1 to clear). */
+#define BM_STA_INTR 0x04        /* Disk interrupted (write 1 to clear). */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +67,30 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors we transfer with a single command.  The sector
+   count register is 8 bits wide; we stay well under its limit. */
+#define IDE_MAX_SECTORS 128
+
+/* Pages in each channel's DMA bounce buffer, which is used when
+   the caller's buffer is not in kernel memory. */
+#define BOUNCE_PAGES (IDE_MAX_SECTORS * BLOCK_SECTOR_SIZE / PGSIZE)
+
+/* A physical region descriptor, which tells the bus master one
+   stretch of physical memory to transfer.  A region may not
+   cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes; 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT in the table's last entry. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* -dma: Use bus-master DMA if possible? */
+bool ide_use_dma;
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +99,7 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool dma;                   /* Transfer data by bus-master DMA? */
   };
 
 /* An ATA channel (aka controller).
@@ -72,6 +115,15 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    /* Requests for both disks, carried out by the channel's own
+       worker thread so that the two channels run in parallel. */
+    struct block_queue *queue;
+
+    /* Bus-master DMA, if bm_base is nonzero. */
+    uint16_t bm_base;           /* Bus master I/O port base. */
+    struct prd *prdt;           /* Physical region descriptor table. */
+    uint8_t *bounce;            /* Bounce buffer of BOUNCE_PAGES pages. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -85,7 +137,7 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static void select_sector (struct ata_disk *, block_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -95,6 +147,10 @@ static bool wait_while_busy (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
+static uint16_t find_bus_master (void);
+static void dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                          void *buffer, bool write);
+
 static void interrupt_handler (struct intr_frame *);
 
 /* Initialize the disk subsystem and detect disks. */
@@ -102,6 +158,14 @@ void
 ide_init (void)
 {
   size_t chan_no;
+  uint16_t bm_base = 0;
+
+  if (ide_use_dma)
+    {
+      bm_base = find_bus_master ();
+      if (bm_base == 0)
+        printf ("ide: no bus-master IDE controller, using PIO\n");
+    }
 
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
@@ -126,6 +190,14 @@ ide_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->queue = block_queue_create (c->name);
+      c->bm_base = 0;
+      if (bm_base != 0)
+        {
+          c->bm_base = bm_base + chan_no * 8;
+          c->prdt = palloc_get_page (PAL_ASSERT);
+          c->bounce = palloc_get_multiple (PAL_ASSERT, BOUNCE_PAGES);
+        }
 
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +208,7 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -284,10 +357,12 @@ identify_ata_device (struct ata_disk *d)
   /* Calculate capacity.
      Read model name and serial number. */
   capacity = *(uint32_t *) &id[60 * 2];
+  d->dma = c->bm_base != 0 && (*(uint16_t *) &id[49 * 2] & 0x100) != 0;
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
   snprintf (extra_info, sizeof extra_info,
-            "model \"%s\", serial \"%s\"", model, serial);
+            "model \"%s\", serial \"%s\"%s", model, serial,
+            d->dma ? ", DMA" : "");
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -306,6 +381,7 @@ identify_ata_device (struct ata_disk *d)
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+  block_set_queue (block, c->queue);
   partition_scan (block);
 }
 
@@ -337,6 +413,66 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   which must have room for CNT * BLOCK_SECTOR_SIZE bytes, using a
+   single READ SECTOR command.  The disk interrupts once per
+   sector as each becomes ready.  CNT must be between 1 and
+   IDE_MAX_SECTORS.  Must be called with D's channel locked. */
+static void
+read_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              uint8_t *buffer)
+{
+  struct channel *c = d->channel;
+  size_t i;
+
+  if (d->dma)
+    {
+      dma_transfer (d, sec_no, cnt, buffer, false);
+      return;
+    }
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+  for (i = 0; i < cnt; i++)
+    {
+      sema_down (&c->completion_wait);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name,
+               sec_no + i);
+      input_sector (c, buffer + i * BLOCK_SECTOR_SIZE);
+    }
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   which must contain CNT * BLOCK_SECTOR_SIZE bytes, using a
+   single WRITE SECTOR command.  Returns after the disk has
+   acknowledged receiving the last sector.  CNT must be between 1
+   and IDE_MAX_SECTORS.  Must be called with D's channel locked. */
+static void
+write_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+               const uint8_t *buffer)
+{
+  struct channel *c = d->channel;
+  size_t i;
+
+  if (d->dma)
+    {
+      dma_transfer (d, sec_no, cnt, (void *) buffer, true);
+      return;
+    }
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
+  for (i = 0; i < cnt; i++)
+    {
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name,
+               sec_no + i);
+      output_sector (c, buffer + i * BLOCK_SECTOR_SIZE);
+      sema_down (&c->completion_wait);
+    }
+}
+
 /* Reads sector SEC_NO from disk D into BUFFER, which must have
    room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to disks, so external
@@ -347,12 +483,7 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
+  read_sectors (d, sec_no, 1, buffer);
   lock_release (&c->lock);
 }
 
@@ -367,33 +498,75 @@ ide_write (void *d_, block_sector_t sec_no, const void *buffer)
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  write_sectors (d, sec_no, 1, buffer);
+  lock_release (&c->lock);
+}
+
+/* Reads CNT sectors starting at SEC_NO from disk D into BUFFER,
+   up to IDE_MAX_SECTORS per command. */
+static void
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                   void *buffer_)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  uint8_t *buffer = buffer_;
+
+  lock_acquire (&c->lock);
+  while (cnt > 0)
+    {
+      size_t chunk = cnt < IDE_MAX_SECTORS ? cnt : IDE_MAX_SECTORS;
+      read_sectors (d, sec_no, chunk, buffer);
+      sec_no += chunk;
+      buffer += chunk * BLOCK_SECTOR_SIZE;
+      cnt -= chunk;
+    }
+  lock_release (&c->lock);
+}
+
+/* Writes CNT sectors starting at SEC_NO to disk D from BUFFER,
+   up to IDE_MAX_SECTORS per command. */
+static void
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *buffer_)
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+  const uint8_t *buffer = buffer_;
+
+  lock_acquire (&c->lock);
+  while (cnt > 0)
+    {
+      size_t chunk = cnt < IDE_MAX_SECTORS ? cnt : IDE_MAX_SECTORS;
+      write_sectors (d, sec_no, chunk, buffer);
+      sec_no += chunk;
+      buffer += chunk * BLOCK_SECTOR_SIZE;
+      cnt -= chunk;
+    }
   lock_release (&c->lock);
 }
 
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple
   };
-
+
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the sector count CNT to the disk's sector
+   selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
   ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= IDE_MAX_SECTORS);
 
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -402,7 +575,8 @@ select_sector (struct ata_disk *d, block_sector_t sec_no)
 }
 
 /* Writes COMMAND to channel C and prepares for receiving a
-   completion interrupt. */
+   completion interrupt.  Also used for DMA commands, which
+   likewise interrupt on completion. */
 static void
 issue_pio_command (struct channel *c, uint8_t command)
 {
@@ -430,6 +604,138 @@ output_sector (struct channel *c, const void *sector)
   outsw (reg_data (c), sector, BLOCK_SECTOR_SIZE / 2);
 }
 
+/* Bus-master DMA. */
+
+/* PCI configuration space access ports. */
+#define PCI_CONFIG_ADDRESS 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+/* Returns the 32-bit PCI configuration register REG of function
+   FUNC of device DEV on bus 0. */
+static uint32_t
+pci_read_config (int dev, int func, int reg)
+{
+  outl (PCI_CONFIG_ADDRESS, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Writes VALUE to PCI configuration register REG of function
+   FUNC of device DEV on bus 0. */
+static void
+pci_write_config (int dev, int func, int reg, uint32_t value)
+{
+  outl (PCI_CONFIG_ADDRESS, 0x80000000 | (dev << 11) | (func << 8) | reg);
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Looks on PCI bus 0 for an IDE controller capable of bus
+   mastering, such as the PIIX that QEMU emulates, and enables
+   bus mastering on it.  Returns the base of its bus master I/O
+   ports, or 0 if there is no such controller. */
+static uint16_t
+find_bus_master (void)
+{
+  int dev, func;
+
+  for (dev = 0; dev < 32; dev++)
+    for (func = 0; func < 8; func++)
+      {
+        uint32_t class, bar;
+
+        if ((pci_read_config (dev, func, 0x00) & 0xffff) == 0xffff)
+          continue;
+
+        /* Mass storage (0x01), IDE (0x01), bus master capable. */
+        class = pci_read_config (dev, func, 0x08);
+        if ((class >> 16) != 0x0101 || !(class & 0x8000))
+          continue;
+
+        /* BAR4 must map the bus master ports into I/O space. */
+        bar = pci_read_config (dev, func, 0x20);
+        if (!(bar & 1) || (bar & 0xfffc) == 0)
+          continue;
+
+        /* Enable I/O space and bus mastering. */
+        pci_write_config (dev, func, 0x04,
+                          pci_read_config (dev, func, 0x04) | 0x5);
+        return bar & 0xfffc;
+      }
+  return 0;
+}
+
+/* Fills in channel C's PRD table to describe the SIZE bytes at
+   BUFFER, which must be in kernel memory and so is physically
+   contiguous. */
+static void
+build_prdt (struct channel *c, void *buffer, size_t size)
+{
+  uint32_t phys = vtop (buffer);
+  struct prd *prd = c->prdt;
+
+  ASSERT (size > 0 && (phys & 1) == 0);
+
+  for (;;)
+    {
+      size_t chunk = 0x10000 - (phys & 0xffff);
+      if (chunk > size)
+        chunk = size;
+
+      prd->addr = phys;
+      prd->size = chunk & 0xffff;
+      prd->flags = 0;
+      phys += chunk;
+      size -= chunk;
+      if (size == 0)
+        break;
+      prd++;
+    }
+  prd->flags = PRD_EOT;
+}
+
+/* Transfers CNT sectors starting at SEC_NO between disk D and
+   BUFFER by bus-master DMA: from disk to BUFFER if WRITE is
+   false, or from BUFFER to disk if it is true.  The calling
+   thread sleeps until the transfer completes, leaving the CPU
+   free for other threads.  A buffer outside kernel memory, or
+   misaligned, goes through the channel's bounce buffer.  Must be
+   called with D's channel locked. */
+static void
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              void *buffer, bool write)
+{
+  struct channel *c = d->channel;
+  size_t size = cnt * BLOCK_SECTOR_SIZE;
+  uint8_t direction = write ? 0 : BM_CMD_READ;
+  bool bounce = !is_kernel_vaddr (buffer) || ((uintptr_t) buffer & 1);
+  void *dma_buffer = bounce ? c->bounce : buffer;
+  uint8_t bm_status;
+
+  ASSERT (cnt > 0 && cnt <= IDE_MAX_SECTORS);
+
+  if (bounce && write)
+    memcpy (dma_buffer, buffer, size);
+
+  build_prdt (c, dma_buffer, size);
+  outl (reg_bm_prdt (c), vtop (c->prdt));
+  outb (reg_bm_command (c), direction);
+  outb (reg_bm_status (c), BM_STA_ERROR | BM_STA_INTR);
+
+  select_sector (d, sec_no, cnt);
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (reg_bm_command (c), direction | BM_CMD_START);
+  sema_down (&c->completion_wait);
+
+  outb (reg_bm_command (c), direction);
+  bm_status = inb (reg_bm_status (c));
+  outb (reg_bm_status (c), BM_STA_ERROR | BM_STA_INTR);
+  if ((bm_status & BM_STA_ERROR) || (inb (reg_alt_status (c)) & STA_ERR))
+    PANIC ("%s: DMA %s failed, sector=%"PRDSNu, d->name,
+           write ? "write" : "read", sec_no);
+
+  if (bounce && !write)
+    memcpy (buffer, dma_buffer, size);
+}
+
 /* Low-level ATA primitives. */
 
 /* Wait up to 10 seconds for the controller to become idle, that
@@ -1,6 +1,13 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+#include <stdbool.h>
+
+/* Use bus-master DMA for disk transfers, if the controller
+   supports it.
+   Controlled by kernel command-line option "-dma". */
+extern bool ide_use_dma;
+
 void ide_init (void);
 
 #endif /* devices/ide.h */
@@ -0,0 +1,124 @@
+#include "devices/ramdisk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* A block device whose sectors live in kernel memory, for
+   measuring the file system without the cost of an emulated
+   disk.  Its contents are lost at shutdown.
+
+   The memory is a set of separately allocated pages, so a large
+   RAM disk does not need a large contiguous range of the kernel
+   pool. */
+
+/* -ramdisk: Size in kB. */
+size_t ramdisk_kb;
+
+/* -ramdisk-load: Preload from the scratch device? */
+bool ramdisk_preload;
+
+/* Sectors in one page of the RAM disk. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A RAM disk. */
+struct ramdisk
+  {
+    struct block *block;        /* Registered block device. */
+    block_sector_t size;        /* Size in sectors. */
+    uint8_t **pages;            /* Pages holding the sectors. */
+  };
+
+static struct ramdisk ram0;
+
+static struct block_operations ramdisk_operations;
+
+/* Allocates and registers the RAM disk "ram0", if one was asked
+   for with -ramdisk.  Its contents start out zeroed.  It has type
+   BLOCK_RAW, so it is used only when named, e.g. by -filesys or
+   -swap. */
+void
+ramdisk_init (void)
+{
+  struct ramdisk *rd = &ram0;
+  size_t page_cnt, i;
+  char extra_info[32];
+
+  if (ramdisk_kb == 0)
+    return;
+
+  page_cnt = DIV_ROUND_UP (ramdisk_kb * 1024, PGSIZE);
+  rd->size = page_cnt * SECTORS_PER_PAGE;
+  rd->pages = malloc (page_cnt * sizeof *rd->pages);
+  if (rd->pages == NULL)
+    PANIC ("ram0: failed to allocate page table");
+  for (i = 0; i < page_cnt; i++)
+    {
+      rd->pages[i] = palloc_get_page (PAL_ZERO);
+      if (rd->pages[i] == NULL)
+        PANIC ("ram0: out of memory after %zu of %zu pages", i, page_cnt);
+    }
+
+  snprintf (extra_info, sizeof extra_info, "%zu kB of RAM", page_cnt * (PGSIZE / 1024));
+  rd->block = block_register ("ram0", BLOCK_RAW, extra_info, rd->size,
+                              &ramdisk_operations, rd);
+}
+
+/* Copies SRC, or as much of it as fits, into the RAM disk. */
+void
+ramdisk_load (struct block *src)
+{
+  struct ramdisk *rd = &ram0;
+  block_sector_t sector, size;
+
+  if (rd->block == NULL)
+    PANIC ("-ramdisk-load requires -ramdisk");
+  if (src == NULL)
+    PANIC ("-ramdisk-load requires a scratch device");
+
+  size = block_size (src) < rd->size ? block_size (src) : rd->size;
+  for (sector = 0; sector < size; sector += SECTORS_PER_PAGE)
+    {
+      size_t cnt = size - sector < SECTORS_PER_PAGE
+                   ? size - sector : SECTORS_PER_PAGE;
+      block_read_multiple (src, sector, cnt,
+                           rd->pages[sector / SECTORS_PER_PAGE]);
+    }
+  printf ("%s: loaded %'"PRDSNu" sectors from %s\n",
+          block_name (rd->block), size, block_name (src));
+}
+
+/* Returns the address of SECTOR in RD. */
+static uint8_t *
+sector_addr (struct ramdisk *rd, block_sector_t sector)
+{
+  return (rd->pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SECTOR of RAM disk RD_ into BUFFER.  Only the device's
+   worker thread calls this, so no locking is needed. */
+static void
+ramdisk_read (void *rd_, block_sector_t sector, void *buffer)
+{
+  memcpy (buffer, sector_addr (rd_, sector), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes BUFFER to SECTOR of RAM disk RD_. */
+static void
+ramdisk_write (void *rd_, block_sector_t sector, const void *buffer)
+{
+  memcpy (sector_addr (rd_, sector), buffer, BLOCK_SECTOR_SIZE);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    NULL,
+    NULL
+  };
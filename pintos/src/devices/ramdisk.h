@@ -0,0 +1,20 @@
+#ifndef DEVICES_RAMDISK_H
+#define DEVICES_RAMDISK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+struct block;
+
+/* Size of the RAM disk in kB, or 0 for no RAM disk.
+   Controlled by kernel command-line option "-ramdisk". */
+extern size_t ramdisk_kb;
+
+/* Copy the scratch device into the RAM disk at boot?
+   Controlled by kernel command-line option "-ramdisk-load". */
+extern bool ramdisk_preload;
+
+void ramdisk_init (void);
+void ramdisk_load (struct block *);
+
+#endif /* devices/ramdisk.h */
@@ -0,0 +1,201 @@
+#include "devices/stripe.h"
+#include <debug.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/block.h"
+#include "threads/malloc.h"
+
+/* A striped (RAID-0) block device, which spreads its sectors
+   across several member devices in chunks of a fixed number of
+   sectors: chunk 0 on the first member, chunk 1 on the second,
+   and so on round-robin.  A large transfer is split into one
+   request per chunk, and the requests for all the members are
+   submitted before any is waited for, so members on different
+   IDE channels transfer in parallel.  There is no redundancy. */
+
+/* Most members in a stripe set. */
+#define STRIPE_MAX_MEMBERS 4
+
+/* Default chunk size in sectors. */
+#define STRIPE_DEFAULT_CHUNK 8
+
+/* Member requests that stripe_transfer() keeps on its stack. */
+#define STRIPE_REQS_INLINE 4
+
+/* A striped device. */
+struct stripe
+  {
+    struct block *block;                /* Registered block device. */
+    struct block *members[STRIPE_MAX_MEMBERS];
+    size_t member_cnt;
+    block_sector_t chunk;               /* Chunk size in sectors. */
+  };
+
+/* -stripe: Names of the member devices and the chunk size. */
+static const char *member_names[STRIPE_MAX_MEMBERS];
+static size_t member_name_cnt;
+static block_sector_t chunk_size = STRIPE_DEFAULT_CHUNK;
+
+static struct stripe md0;
+
+static struct block_operations stripe_operations;
+
+/* Configures the striped device from SPEC, the value of the
+   -stripe option: DEV,DEV[,...][:CHUNK], naming between 2 and
+   STRIPE_MAX_MEMBERS member devices and optionally the chunk
+   size in sectors.  Modifies SPEC.  Returns false if SPEC is
+   malformed. */
+bool
+stripe_configure (char *spec)
+{
+  char *colon = strchr (spec, ':');
+  char *name, *save_ptr;
+
+  if (colon != NULL)
+    {
+      *colon = '\0';
+      chunk_size = atoi (colon + 1);
+      if (chunk_size == 0)
+        return false;
+    }
+
+  member_name_cnt = 0;
+  for (name = strtok_r (spec, ",", &save_ptr); name != NULL;
+       name = strtok_r (NULL, ",", &save_ptr))
+    {
+      if (member_name_cnt >= STRIPE_MAX_MEMBERS)
+        return false;
+      member_names[member_name_cnt++] = name;
+    }
+  return member_name_cnt >= 2;
+}
+
+/* Registers the striped device "md0" over the members given with
+   -stripe, if any.  Its size is the largest multiple of the
+   stripe width (chunk size times member count) that fits on every
+   member.  It has type BLOCK_RAW, so it is used only when named,
+   e.g. by -filesys. */
+void
+stripe_init (void)
+{
+  struct stripe *s = &md0;
+  block_sector_t member_size = 0;
+  char extra_info[128];
+  size_t i;
+  int len;
+
+  if (member_name_cnt == 0)
+    return;
+
+  s->chunk = chunk_size;
+  len = snprintf (extra_info, sizeof extra_info, "%"PRDSNu"-sector chunks on",
+                  s->chunk);
+  for (i = 0; i < member_name_cnt; i++)
+    {
+      struct block *member = block_get_by_name (member_names[i]);
+      if (member == NULL)
+        PANIC ("md0: no such block device \"%s\"", member_names[i]);
+      if (i == 0 || block_size (member) < member_size)
+        member_size = block_size (member);
+      s->members[i] = member;
+      if (len < (int) sizeof extra_info)
+        len += snprintf (extra_info + len, sizeof extra_info - len, " %s",
+                         block_name (member));
+    }
+  s->member_cnt = member_name_cnt;
+
+  member_size -= member_size % s->chunk;
+  if (member_size == 0)
+    PANIC ("md0: members are smaller than one chunk");
+  s->block = block_register ("md0", BLOCK_RAW, extra_info,
+                             member_size * s->member_cnt,
+                             &stripe_operations, s);
+}
+
+/* Transfers CNT sectors starting at SECTOR between stripe S and
+   BUFFER, in the direction given by OP.  Submits a request to the
+   right member for each chunk that the range touches, then waits
+   for all of them.  A transfer of up to STRIPE_REQS_INLINE chunks,
+   such as any single sector, needs no memory allocation. */
+static void
+stripe_transfer (struct stripe *s, enum block_op op, block_sector_t sector,
+                 size_t cnt, uint8_t *buffer)
+{
+  struct block_request reqs_inline[STRIPE_REQS_INLINE];
+  size_t req_max = cnt / s->chunk + 2;
+  struct block_request *reqs = reqs_inline;
+  size_t req_cnt = 0;
+  size_t i;
+
+  if (req_max > STRIPE_REQS_INLINE)
+    {
+      reqs = malloc (req_max * sizeof *reqs);
+      if (reqs == NULL)
+        PANIC ("%s: out of memory", block_name (s->block));
+    }
+
+  while (cnt > 0)
+    {
+      block_sector_t chunk_no = sector / s->chunk;
+      block_sector_t ofs = sector % s->chunk;
+      size_t piece = s->chunk - ofs < cnt ? s->chunk - ofs : cnt;
+      struct block *member = s->members[chunk_no % s->member_cnt];
+      block_sector_t member_sector = chunk_no / s->member_cnt * s->chunk + ofs;
+
+      ASSERT (req_cnt < req_max);
+      block_request_init (&reqs[req_cnt], op, member_sector, piece, buffer,
+                          NULL, NULL);
+      block_submit (member, &reqs[req_cnt]);
+      req_cnt++;
+
+      sector += piece;
+      cnt -= piece;
+      buffer += piece * BLOCK_SECTOR_SIZE;
+    }
+
+  for (i = 0; i < req_cnt; i++)
+    block_wait (&reqs[i]);
+  if (reqs != reqs_inline)
+    free (reqs);
+}
+
+/* Reads SECTOR from stripe S_ into BUFFER. */
+static void
+stripe_read (void *s_, block_sector_t sector, void *buffer)
+{
+  stripe_transfer (s_, BLOCK_READ, sector, 1, buffer);
+}
+
+/* Writes BUFFER to SECTOR of stripe S_. */
+static void
+stripe_write (void *s_, block_sector_t sector, const void *buffer)
+{
+  stripe_transfer (s_, BLOCK_WRITE, sector, 1, (void *) buffer);
+}
+
+/* Reads CNT sectors starting at SECTOR from stripe S_ into
+   BUFFER. */
+static void
+stripe_read_multiple (void *s_, block_sector_t sector, size_t cnt,
+                      void *buffer)
+{
+  stripe_transfer (s_, BLOCK_READ, sector, cnt, buffer);
+}
+
+/* Writes CNT sectors starting at SECTOR to stripe S_ from
+   BUFFER. */
+static void
+stripe_write_multiple (void *s_, block_sector_t sector, size_t cnt,
+                       const void *buffer)
+{
+  stripe_transfer (s_, BLOCK_WRITE, sector, cnt, (void *) buffer);
+}
+
+static struct block_operations stripe_operations =
+  {
+    stripe_read,
+    stripe_write,
+    stripe_read_multiple,
+    stripe_write_multiple
+  };
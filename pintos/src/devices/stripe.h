@@ -0,0 +1,9 @@
+#ifndef DEVICES_STRIPE_H
+#define DEVICES_STRIPE_H
+
+#include <stdbool.h>
+
+bool stripe_configure (char *spec);
+void stripe_init (void);
+
+#endif /* devices/stripe.h */
@@ -24,11 +24,19 @@ static int64_t ticks;
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* Time-stamp counter increments per microsecond, or 0 if not yet
+   known.  Initialized by timer_calibrate(). */
+static uint64_t tsc_per_usec;
+
+/* Timer ticks over which to measure the time-stamp counter. */
+#define TSC_CALIBRATE_TICKS 5
+
 static intr_handler_func timer_interrupt;
 static bool too_many_loops (unsigned loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
+static uint64_t rdtsc (void);
 
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
@@ -64,6 +72,41 @@ timer_calibrate (void)
       loops_per_tick |= test_bit;
 
   printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+
+  /* Count time-stamp counter increments over a few whole ticks. */
+  {
+    int64_t start = timer_ticks ();
+    uint64_t tsc;
+
+    while (timer_ticks () == start)
+      barrier ();
+    tsc = rdtsc ();
+    start = timer_ticks ();
+    while (timer_elapsed (start) < TSC_CALIBRATE_TICKS)
+      barrier ();
+    tsc_per_usec = ((rdtsc () - tsc)
+                    / (TSC_CALIBRATE_TICKS * (1000000 / TIMER_FREQ)));
+  }
+}
+
+/* Returns the number of microseconds since an arbitrary point in
+   the past, with far finer resolution than timer_ticks() when
+   the processor's time-stamp counter is usable. */
+uint64_t
+timer_usecs (void)
+{
+  if (tsc_per_usec == 0)
+    return (uint64_t) timer_ticks () * (1000000 / TIMER_FREQ);
+  return rdtsc () / tsc_per_usec;
+}
+
+/* Returns the processor's time-stamp counter. */
+static uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
 }
 
 /* Returns the number of timer ticks since the OS booted. */
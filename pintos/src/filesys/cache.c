@@ -1,190 +1,981 @@
 #include "filesys/cache.h"
 #include <string.h>
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/thread.h"
 #include "threads/synch.h"
 #include "devices/timer.h"
-#include <threads/synch.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
 #include <stdbool.h>
+#include <debug.h>
+#include <hash.h>
+#include <stdlib.h>
+#include <stdio.h>
 #include <list.h>
+#include <round.h>
 
-#define CACHE_SIZE 64
-int clock_hand = 0;
+/* The cache is split into independently locked shards, each with
+   its own index and clock, so that threads touching different
+   sectors don't contend on a single lock. */
+#define CACHE_SHARD_CNT 8
+
+/* Smallest cache we will run with: two entries per shard. */
+#define CACHE_MIN_SIZE (2 * CACHE_SHARD_CNT)
+
+/* Sectors of cached data that fit in one page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* -cache: Number of sectors to cache, or if cache_size_pct is
+   nonzero, the percentage of the kernel page pool to use. */
+size_t cache_size = 64;
+unsigned cache_size_pct;
+
+/* -cache-policy: Replacement policy. */
+enum cache_policy cache_policy = CACHE_POLICY_2Q;
+
+/* -flush: Milliseconds between write-behind passes; 0 disables
+   the flusher thread. */
+unsigned cache_flush_msecs = 1000;
+
+/* -ra: Number of sectors to read ahead of a sequential reader;
+   0 disables read-ahead. */
+unsigned cache_readahead_window = 4;
 
 struct cache_entry
   {
-    char data[512];
-    struct lock lox;
+    uint8_t *data;                      /* BLOCK_SECTOR_SIZE bytes of data. */
+    struct cache_shard *shard;          /* Shard that owns this entry. */
     bool dirty;
-    bool valid;
-    struct list_elem elem;
+    bool valid;                         /* Clock reference bit. */
+    bool prefetched;                    /* Read ahead, not yet used. */
+    struct hash_elem hash_elem;         /* Element in shard's index. */
+    block_sector_t sector;
+    struct list_elem queue_elem;        /* Element in a 2Q queue. */
+    struct list *queue;                 /* 2Q queue holding this entry. */
+
+    /* Access control, protected by the shard's lock.  An entry
+       with a nonzero pin_cnt is never chosen for eviction. */
+    int pin_cnt;                        /* Holders plus waiters. */
+    int readers;                        /* Threads holding CACHE_SHARED. */
+    bool writer;                        /* Held CACHE_EXCLUSIVE? */
+    struct condition unlocked;          /* Signaled when access is released. */
+
+    struct block_request io;            /* Read-ahead or write-behind I/O. */
+  };
+
+/* A shard of the cache.  Every member, and the access-control
+   members of each of its entries, is protected by LOCK. */
+struct cache_shard
+  {
+    struct lock lock;
+    struct condition unpinned;          /* Signaled when a pin drops to 0. */
+
+    /* Maps a sector number to the cache_entry holding it, so
+       lookups don't have to scan blocks[]. */
+    struct hash index;
+    struct cache_entry lookup_key;
+
+    struct cache_entry *blocks;         /* Array of SIZE entries. */
+    int size;
+    int blocks_used;                    /* Slots of blocks[] in use. */
+    int clock_hand;
+
+    /* 2Q state.  New entries wait on probation in a1in (FIFO);
+       entries referenced again soon after leaving it live in am
+       (LRU).  a1out is a ring of recently evicted a1in sectors.
+       Once a1in holds more than a1in_max entries eviction prefers
+       them; a1out remembers up to a1out_max sectors. */
+    struct list a1in;
+    struct list am;
+    int a1in_cnt;
+    int a1in_max;
+    block_sector_t *a1out;
+    int a1out_cnt;
+    int a1out_max;
+    int a1out_next;
+
+    struct cache_stats stats;
+  };
+
+static struct cache_shard shards[CACHE_SHARD_CNT];
+
+/* A dirty entry and the sector it held when it was picked for
+   write-back. */
+struct dirty_block
+  {
+    struct cache_entry *block;
     block_sector_t sector;
   };
 
+/* Scratch space for write-behind, one slot per cache entry. */
+static struct dirty_block *dirty_blocks;
+static struct lock write_behind_lock;
 
-static struct cache_entry blocks[CACHE_SIZE];
+static size_t cache_write_behind (void);
+static thread_func flusher;
 
-static struct list clock_list; 
-static struct lock clock_lock; 
+static unsigned
+cache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct cache_entry *block = hash_entry (e, struct cache_entry,
+                                                hash_elem);
+  return hash_int (block->sector);
+}
+
+static bool
+cache_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct cache_entry, hash_elem)->sector
+          < hash_entry (b, struct cache_entry, hash_elem)->sector);
+}
 
-void cache_init (void) 
+/* Returns the number of sectors to cache, as configured on the
+   kernel command line.  The cache never takes more than half of
+   the kernel pool, so the rest of the kernel can still run. */
+static size_t
+configured_size (void)
 {
-  list_init (&clock_list);
-  lock_init (&clock_lock);
-  int i = 0;
+  size_t pool_sectors = palloc_kernel_pages () * SECTORS_PER_PAGE;
+  size_t size = cache_size;
+
+  if (cache_size_pct > 0)
+    size = pool_sectors / 100 * cache_size_pct;
+  if (size > pool_sectors / 2)
+    size = pool_sectors / 2;
+  if (size < CACHE_MIN_SIZE)
+    size = CACHE_MIN_SIZE;
+  return ROUND_UP (size, CACHE_SHARD_CNT);
+}
+
+/* Initializes the buffer cache, allocating its data from whole
+   kernel pages. */
+void cache_init (void)
+{
+  struct cache_shard *shard;
   struct cache_entry *block;
-  for (; i < CACHE_SIZE; i++) 
-  {
-    block = &blocks[i];
-    lock_init (&block->lox);
-    block->valid = 0;
-    block->dirty = 0;
-  }
+  uint8_t *page = NULL;
+  size_t sectors_left = 0;
+
+  cache_size = configured_size ();
+  dirty_blocks = malloc (cache_size * sizeof *dirty_blocks);
+  if (dirty_blocks == NULL)
+    PANIC ("buffer cache allocation failed");
+  lock_init (&write_behind_lock);
+
+  for (shard = shards; shard < shards + CACHE_SHARD_CNT; shard++)
+    {
+      lock_init (&shard->lock);
+      cond_init (&shard->unpinned);
+      if (!hash_init (&shard->index, cache_hash, cache_less, NULL))
+        PANIC ("buffer cache index allocation failed");
+      shard->size = cache_size / CACHE_SHARD_CNT;
+      shard->blocks = malloc (shard->size * sizeof *shard->blocks);
+      shard->blocks_used = 0;
+      shard->clock_hand = 0;
+      list_init (&shard->a1in);
+      list_init (&shard->am);
+      shard->a1in_cnt = 0;
+      shard->a1in_max = shard->size / 4 > 0 ? shard->size / 4 : 1;
+      shard->a1out_max = shard->size / 2 > 0 ? shard->size / 2 : 1;
+      shard->a1out = malloc (shard->a1out_max * sizeof *shard->a1out);
+      shard->a1out_cnt = 0;
+      shard->a1out_next = 0;
+      memset (&shard->stats, 0, sizeof shard->stats);
+      if (shard->blocks == NULL || shard->a1out == NULL)
+        PANIC ("buffer cache allocation failed");
+
+      for (block = shard->blocks; block < shard->blocks + shard->size;
+           block++)
+        {
+          if (sectors_left == 0)
+            {
+              page = palloc_get_page (PAL_ASSERT);
+              sectors_left = SECTORS_PER_PAGE;
+            }
+          block->data = page;
+          page += BLOCK_SECTOR_SIZE;
+          sectors_left--;
+
+          block->shard = shard;
+          block->valid = 0;
+          block->dirty = 0;
+          block->prefetched = 0;
+          block->queue = NULL;
+          block->pin_cnt = 0;
+          block->readers = 0;
+          block->writer = false;
+          cond_init (&block->unlocked);
+        }
+    }
+
+
+  if (cache_flush_msecs > 0)
+    thread_create ("cache_flusher", PRI_DEFAULT, flusher, NULL);
+}
+
+/* Sets the cache size from the -cache option VALUE: a number of
+   sectors, or a percentage of the kernel page pool if VALUE ends
+   in "%".  Returns false if VALUE is malformed. */
+bool
+cache_set_size (const char *value)
+{
+  size_t len = strlen (value);
+  int n = atoi (value);
+
+  if (len == 0 || n <= 0)
+    return false;
+  if (value[len - 1] == '%')
+    {
+      if (n > 100)
+        return false;
+      cache_size_pct = n;
+    }
+  else
+    {
+      cache_size = n;
+      cache_size_pct = 0;
+    }
+  return true;
+}
+
+/* Write-behind thread: periodically writes dirty entries back so
+   that eviction usually finds a clean victim.  Open inodes that
+   have changed are written into the cache first, so that they go
+   out in the same pass. */
+static void
+flusher (void *aux UNUSED)
+{
+  for (;;)
+    {
+      timer_msleep (cache_flush_msecs);
+      if (fs_device != NULL)
+        {
+          inode_flush ();
+          cache_write_behind ();
+        }
+    }
+}
+
+/* Returns the shard responsible for SECTOR.  Consecutive sectors
+   land in different shards, so a sequential scan spreads out. */
+static struct cache_shard *
+sector_to_shard (block_sector_t sector)
+{
+  return &shards[sector % CACHE_SHARD_CNT];
+}
+
+/* Acquires SHARD's lock, accounting for any time spent waiting
+   for it. */
+static void
+shard_lock (struct cache_shard *shard)
+{
+  if (!lock_try_acquire (&shard->lock))
+    {
+      uint64_t start = timer_usecs ();
+      lock_acquire (&shard->lock);
+      shard->stats.lock_waits++;
+      shard->stats.lock_wait_usecs += timer_usecs () - start;
+    }
+}
+
+/* Selects the replacement policy named NAME, "clock" or "2q".
+   Returns false if NAME is not a known policy. */
+bool
+cache_set_policy (const char *name)
+{
+  if (!strcmp (name, "clock"))
+    cache_policy = CACHE_POLICY_CLOCK;
+  else if (!strcmp (name, "2q"))
+    cache_policy = CACHE_POLICY_2Q;
+  else
+    return false;
+  return true;
+}
+
+/* Returns the entry of SHARD holding SECTOR, or a null pointer if
+   SECTOR is not cached.  Must be called with SHARD's lock held. */
+static struct cache_entry *
+cache_lookup (struct cache_shard *shard, block_sector_t sector)
+{
+  struct hash_elem *e;
+
+  shard->lookup_key.sector = sector;
+  e = hash_find (&shard->index, &shard->lookup_key.hash_elem);
+  return e != NULL ? hash_entry (e, struct cache_entry, hash_elem) : NULL;
+}
+
+/* Pins BLOCK and waits until it can be held in MODE.
+   Must be called with BLOCK's shard lock held. */
+static void
+entry_acquire (struct cache_entry *block, enum cache_mode mode)
+{
+  struct lock *lock = &block->shard->lock;
+
+  block->pin_cnt++;
+  if (mode == CACHE_SHARED)
+    {
+      while (block->writer)
+        cond_wait (&block->unlocked, lock);
+      block->readers++;
+    }
+  else
+    {
+      while (block->writer || block->readers > 0)
+        cond_wait (&block->unlocked, lock);
+      block->writer = true;
+    }
+}
+
+/* Releases access to BLOCK obtained with entry_acquire() and
+   unpins it.  Must be called with BLOCK's shard lock held. */
+static void
+entry_release (struct cache_entry *block)
+{
+  struct cache_shard *shard = block->shard;
+
+  if (block->writer)
+    block->writer = false;
+  else
+    {
+      ASSERT (block->readers > 0);
+      block->readers--;
+    }
+  cond_broadcast (&block->unlocked, &shard->lock);
+  if (--block->pin_cnt == 0)
+    cond_signal (&shard->unpinned, &shard->lock);
+}
+
+/* Writes BLOCK, which must be dirty, back to disk.  Holds BLOCK
+   CACHE_SHARED for the duration of the write, so readers may
+   still use it, but releases SHARD's lock meanwhile.
+   Must be called with SHARD's lock held. */
+static void
+entry_write_back (struct cache_shard *shard, struct cache_entry *block)
+{
+  entry_acquire (block, CACHE_SHARED);
+  lock_release (&shard->lock);
+  block_write (fs_device, block->sector, block->data);
+  shard_lock (shard);
+  shard->stats.writebacks++;
+  block->dirty = 0;
+  entry_release (block);
+}
+
+/* Returns an unpinned eviction candidate from SHARD chosen by the
+   clock algorithm, or a null pointer if every entry is pinned. */
+static struct cache_entry *
+clock_victim (struct cache_shard *shard)
+{
+  struct cache_entry *block;
+  int scanned;
+
+  for (scanned = 0; scanned < 2 * shard->size; scanned++)
+    {
+      block = &shard->blocks[shard->clock_hand];
+      shard->clock_hand = (shard->clock_hand + 1) % shard->size;
+      if (block->pin_cnt > 0)
+        continue;
+      if (block->valid)
+        {
+          block->valid = 0;
+          continue;
+        }
+      return block;
+    }
+  return NULL;
+}
+
+/* Returns the first unpinned entry in QUEUE, or a null pointer if
+   there is none. */
+static struct cache_entry *
+queue_first_unpinned (struct list *queue)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (queue); e != list_end (queue); e = list_next (e))
+    {
+      struct cache_entry *block = list_entry (e, struct cache_entry,
+                                              queue_elem);
+      if (block->pin_cnt == 0)
+        return block;
+    }
+  return NULL;
+}
+
+/* Returns an unpinned eviction candidate from SHARD chosen by 2Q,
+   or a null pointer if every entry is pinned.  Probationary
+   entries go first once a1in is over its quota, so a long
+   sequential scan only churns a1in and leaves am alone. */
+static struct cache_entry *
+twoq_victim (struct cache_shard *shard)
+{
+  struct cache_entry *block = NULL;
+
+  if (shard->a1in_cnt > shard->a1in_max)
+    block = queue_first_unpinned (&shard->a1in);
+  if (block == NULL)
+    block = queue_first_unpinned (&shard->am);
+  if (block == NULL)
+    block = queue_first_unpinned (&shard->a1in);
+  return block;
+}
+
+/* Returns true and forgets SECTOR if it was recently evicted from
+   SHARD's a1in. */
+static bool
+twoq_recall (struct cache_shard *shard, block_sector_t sector)
+{
+  int i;
+
+  for (i = 0; i < shard->a1out_cnt; i++)
+    if (shard->a1out[i] == sector)
+      {
+        shard->a1out[i] = shard->a1out[--shard->a1out_cnt];
+        if (shard->a1out_next > shard->a1out_cnt)
+          shard->a1out_next = shard->a1out_cnt;
+        return true;
+      }
+  return false;
+}
+
+/* Drops BLOCK, which is being evicted, from its 2Q queue.  A
+   probationary entry's sector is remembered in a1out, replacing
+   the oldest remembered sector if a1out is full. */
+static void
+twoq_remove (struct cache_shard *shard, struct cache_entry *block)
+{
+  if (block->queue == NULL)
+    return;
+
+  list_remove (&block->queue_elem);
+  if (block->queue == &shard->a1in)
+    {
+      shard->a1in_cnt--;
+      if (shard->a1out_cnt < shard->a1out_max)
+        shard->a1out[shard->a1out_cnt++] = block->sector;
+      else
+        {
+          shard->a1out[shard->a1out_next] = block->sector;
+          shard->a1out_next = (shard->a1out_next + 1) % shard->a1out_max;
+        }
+    }
+  block->queue = NULL;
+}
+
+/* Adds BLOCK, newly filled with a sector, to a 2Q queue of
+   SHARD. */
+static void
+twoq_insert (struct cache_shard *shard, struct cache_entry *block)
+{
+  if (twoq_recall (shard, block->sector))
+    block->queue = &shard->am;
+  else
+    {
+      block->queue = &shard->a1in;
+      shard->a1in_cnt++;
+    }
+  list_push_back (block->queue, &block->queue_elem);
 }
 
+/* Records a reference to BLOCK of SHARD.  Only am is kept in LRU
+   order; references during probation don't count. */
+static void
+twoq_touch (struct cache_shard *shard, struct cache_entry *block)
+{
+  if (block->queue == &shard->am)
+    {
+      list_remove (&block->queue_elem);
+      list_push_back (&shard->am, &block->queue_elem);
+    }
+}
+
+/* Picks a slot of SHARD for a new sector: an unused one while the
+   shard is filling up, otherwise an unpinned victim chosen by the
+   configured policy, which is dropped from the shard's index.
 
-void cache_read (block_sector_t sector, void *buffer) 
+   A dirty victim is written back first while it is still indexed
+   under its old sector, so that a concurrent lookup of that sector
+   waits for the write instead of reading stale data from disk.
+   Because that releases the shard's lock, as does waiting for a
+   pin to drop when every entry is in use, a null pointer is
+   returned in those cases and the caller must redo its lookup.
+   If FULL is non-null, then instead of waiting for a pin to drop,
+   *FULL is set to true and a null pointer returned at once.
+   Must be called with SHARD's lock held. */
+static struct cache_entry *
+cache_victim (struct cache_shard *shard, bool *full)
 {
-  lock_acquire(&clock_lock);
-  int size = list_size (&clock_list);
-  int i = 0;
   struct cache_entry *block;
 
-  for (; i < size; i++) {
-    block = &blocks[i];
-    if (block->sector == sector) {
-      lock_acquire(&block->lox);
-      lock_release(&clock_lock);
-      memcpy(buffer, block->data, BLOCK_SECTOR_SIZE);
-      // lock_release(&clock_lock);
-      lock_release(&block->lox);
-      return;
-    }
-  }
-
-  if (size < CACHE_SIZE) {
-    block = &blocks[i];
-    block->dirty = 0;
-    block->valid = 0;
-    block->sector = sector;
-
-    list_push_back(&clock_list, &block->elem);
-    lock_acquire (&block->lox);
-    lock_release (&clock_lock);
-    block_read (fs_device, sector, block->data);
-    memcpy (buffer, block->data, BLOCK_SECTOR_SIZE);
-    // lock_release (&clock_lock);
-    lock_release (&block->lox);
-    return; 
-
-  } else {
-  	int idx = clock_hand;
-  	for (int j = 0; j < CACHE_SIZE; j++) {
-  		idx = (idx + j) % CACHE_SIZE;
-  		block = &blocks[idx];
-  		if (block->valid == 0) {
-  			block->valid = 1;
-  			break;
-  		}
-  		block->valid = 0;
-  	}
-  	clock_hand = idx;
-  	lock_acquire (&block->lox);
-  	block_sector_t old = block->sector;
-  	block->sector = sector;
-  	lock_release (&clock_lock);
-
-  	if (block->dirty == 1) {
-  		block_write (fs_device, old, block->data);
-  		block->dirty = 0;
-  	}
-
-    block_read (fs_device, sector, block->data);
-    memcpy (buffer, block->data, BLOCK_SECTOR_SIZE);
-
-    // lock_release (&clock_lock);
-    lock_release (&block->lox);
-    return ;
-  }
-}
-
-void cache_write (block_sector_t sector, const void *buffer) 
-{
-  lock_acquire (&clock_lock);
-  int size = list_size (&clock_list);
-  int i = 0;
+  if (shard->blocks_used < shard->size)
+    return &shard->blocks[shard->blocks_used++];
+
+  if (cache_policy == CACHE_POLICY_2Q)
+    block = twoq_victim (shard);
+  else
+    block = clock_victim (shard);
+
+  if (block == NULL)
+    {
+      if (full != NULL)
+        *full = true;
+      else
+        cond_wait (&shard->unpinned, &shard->lock);
+      return NULL;
+    }
+  if (block->dirty)
+    {
+      entry_write_back (shard, block);
+      return NULL;
+    }
+
+  hash_delete (&shard->index, &block->hash_elem);
+  twoq_remove (shard, block);
+  shard->stats.evictions++;
+  if (block->prefetched)
+    shard->stats.readahead_wasted++;
+  return block;
+}
+
+/* Flags for cache_acquire(). */
+enum acquire_flags
+  {
+    ACQUIRE_LOAD = 001,         /* Read a missing sector from disk. */
+    ACQUIRE_PREFETCH = 002,     /* Read-ahead: skip cached sectors. */
+    ACQUIRE_NOWAIT = 004        /* Don't wait for a free entry. */
+  };
+
+/* Returns the cache entry for SECTOR, pinned and held in MODE.
+   On a miss, evicts a victim and, if FLAGS includes ACQUIRE_LOAD,
+   reads SECTOR from disk into it; otherwise its contents are
+   unspecified and it is returned CACHE_EXCLUSIVE regardless of
+   MODE.  If MISS is non-null, *MISS is set to whether SECTOR was
+   a miss.
+
+   With ACQUIRE_PREFETCH, this is a read-ahead: a sector that is
+   already cached is left alone and a null pointer is returned.
+   With ACQUIRE_NOWAIT, a null pointer is also returned on a miss
+   when every entry of SECTOR's shard is pinned, for callers that
+   hold pins of their own and so must not wait for one to drop. */
+static struct cache_entry *
+cache_acquire (block_sector_t sector, enum cache_mode mode,
+               enum acquire_flags flags, bool *miss)
+{
+  struct cache_shard *shard = sector_to_shard (sector);
   struct cache_entry *block;
+  bool full = false;
+
+  if (miss != NULL)
+    *miss = false;
+
+  shard_lock (shard);
+  for (;;)
+    {
+      block = cache_lookup (shard, sector);
+      if (block != NULL)
+        {
+          if (flags & ACQUIRE_PREFETCH)
+            {
+              lock_release (&shard->lock);
+              return NULL;
+            }
+          shard->stats.hits++;
+          block->valid = 1;
+          if (cache_policy == CACHE_POLICY_2Q)
+            twoq_touch (shard, block);
+          if (block->prefetched)
+            {
+              block->prefetched = 0;
+              shard->stats.readahead_hits++;
+            }
+          entry_acquire (block, mode);
+          lock_release (&shard->lock);
+          return block;
+        }
 
-  for (; i < size; i++) {
-    block = &blocks[i];
-    if (block->sector == sector) {
-      lock_acquire (&block->lox);
-      lock_release (&clock_lock);
-      block->dirty = 1;
-      memcpy (block->data, buffer, BLOCK_SECTOR_SIZE);
-      // lock_release (&clock_lock);
-      lock_release (&block->lox);
-      return;
-    }
-  }
-
-  if (size < CACHE_SIZE) {
-    block = &blocks[i];
-    block->dirty = 1;
-    block->sector = sector;
-    list_push_back(&clock_list, &block->elem);
-    lock_acquire (&block->lox);
-    lock_release (&clock_lock);
-    memcpy (block->data, buffer, BLOCK_SECTOR_SIZE);
-    // lock_release (&clock_lock);
-    lock_release (&block->lox);
-    return ; 
-  }
-  else {
-  	int idx = clock_hand;
-  	for (int j = 0; j < CACHE_SIZE; j++) {
-  		idx = (idx + j) % CACHE_SIZE;
-  		block = &blocks[idx];
-  		if (block->valid == 0) {
-  			block->valid = 1;
-  			break;
-  		}
-  		block->valid = 0;
-  	}
-  	clock_hand = idx;
-    lock_acquire (&block->lox);
-    block_sector_t old = block->sector;
-    block->sector = sector;
-    lock_release (&clock_lock);
-    if (block->dirty == 1) {
-      block_write (fs_device, old, block->data);
-    }
-    block->dirty = 1;
-    memcpy (block->data, buffer, BLOCK_SECTOR_SIZE);
-    // lock_release (&clock_lock);
-    lock_release (&block->lox);
-    return ;
-  }
+      block = cache_victim (shard, flags & ACQUIRE_NOWAIT ? &full : NULL);
+      if (block != NULL)
+        break;
+      if (full)
+        {
+          lock_release (&shard->lock);
+          return NULL;
+        }
+    }
+
+  /* The victim is clean and unpinned, so taking it exclusively
+     does not wait. */
+  if (miss != NULL)
+    *miss = true;
+  shard->stats.misses++;
+  block->sector = sector;
+  block->valid = 1;
+  block->dirty = 0;
+  block->prefetched = (flags & ACQUIRE_PREFETCH) != 0;
+  hash_insert (&shard->index, &block->hash_elem);
+  if (cache_policy == CACHE_POLICY_2Q)
+    twoq_insert (shard, block);
+  entry_acquire (block, CACHE_EXCLUSIVE);
+  lock_release (&shard->lock);
+
+  if (!(flags & ACQUIRE_LOAD))
+    return block;
+  block_read (fs_device, sector, block->data);
+
+  if (mode == CACHE_SHARED)
+    {
+      shard_lock (shard);
+      block->writer = false;
+      block->readers++;
+      cond_broadcast (&block->unlocked, &shard->lock);
+      lock_release (&shard->lock);
+    }
+  return block;
 }
 
-void cache_flush (void) {
-  lock_acquire (&clock_lock);
-  int size = list_size (&clock_list);
+/* Returns the cache entry for SECTOR, reading it from disk if
+   necessary, pinned in the cache and held in MODE: any number of
+   CACHE_SHARED holders, or one CACHE_EXCLUSIVE holder.  Use
+   cache_data() to access its contents in place and cache_put() to
+   release it.  Entries should be held only briefly, since a
+   pinned entry cannot be evicted. */
+struct cache_entry *
+cache_get (block_sector_t sector, enum cache_mode mode)
+{
+  return cache_acquire (sector, mode, ACQUIRE_LOAD, NULL);
+}
+
+/* Returns the BLOCK_SECTOR_SIZE bytes of data cached in BLOCK,
+   which must be held by the caller.  The data may be modified
+   only if BLOCK is held CACHE_EXCLUSIVE, in which case
+   cache_mark_dirty() must also be called. */
+void *
+cache_data (struct cache_entry *block)
+{
+  ASSERT (block->pin_cnt > 0);
+  return block->data;
+}
+
+/* Marks BLOCK, held CACHE_EXCLUSIVE, as modified. */
+void
+cache_mark_dirty (struct cache_entry *block)
+{
+  ASSERT (block->writer);
+  block->dirty = 1;
+}
+
+/* Releases BLOCK, obtained from cache_get(). */
+void
+cache_put (struct cache_entry *block)
+{
+  struct cache_shard *shard = block->shard;
+
+  shard_lock (shard);
+  entry_release (block);
+  lock_release (&shard->lock);
+}
+
+void cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Copies SIZE bytes starting at byte OFS of SECTOR into BUFFER,
+   straight out of the cache entry. */
+void
+cache_read_at (block_sector_t sector, void *buffer, off_t ofs, off_t size)
+{
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  struct cache_entry *block = cache_get (sector, CACHE_SHARED);
+  memcpy (buffer, block->data + ofs, size);
+  cache_put (block);
+}
+
+/* Reads the MISS_CNT sectors starting at SECTOR, whose entries
+   in MISSES are held CACHE_EXCLUSIVE but not yet loaded, in one
+   device request straight into BUFFER.  Then fills and releases
+   the entries. */
+static void
+fill_misses (struct cache_entry **misses, size_t miss_cnt,
+             block_sector_t sector, uint8_t *buffer)
+{
+  size_t i;
+
+  block_read_multiple (fs_device, sector, miss_cnt, buffer);
+  for (i = 0; i < miss_cnt; i++)
+    {
+      memcpy (misses[i]->data, buffer + i * BLOCK_SECTOR_SIZE,
+              BLOCK_SECTOR_SIZE);
+      cache_put (misses[i]);
+    }
+}
+
+/* Reads the CNT consecutive sectors starting at SECTOR into
+   BUFFER.  Cached sectors are copied out of the cache; each run
+   of uncached sectors is read from disk in a single request
+   directly into BUFFER and then installed in the cache.
+
+   The entries of a pending run stay pinned until it is read, so
+   a run is also cut short when it reaches RANGE_MAX sectors or
+   when a shard has no unpinned entry left to give it. */
+#define RANGE_MAX 64
+void
+cache_read_range (block_sector_t sector, size_t cnt, void *buffer_)
+{
+  struct cache_entry *misses[RANGE_MAX];
+  size_t miss_cnt = 0;
+  block_sector_t miss_start = 0;
+  uint8_t *buffer = buffer_;
+  size_t i = 0;
+
+  while (i < cnt)
+    {
+      struct cache_entry *block;
+      bool miss;
+
+      block = cache_acquire (sector + i, CACHE_SHARED,
+                             miss_cnt > 0 ? ACQUIRE_NOWAIT : 0, &miss);
+      if (block != NULL && !miss)
+        memcpy (buffer + i * BLOCK_SECTOR_SIZE, block->data,
+                BLOCK_SECTOR_SIZE);
+
+      /* Read the pending run if this sector ends it. */
+      if (miss_cnt > 0 && (!miss || block == NULL))
+        {
+          fill_misses (misses, miss_cnt, miss_start,
+                       buffer + (miss_start - sector) * BLOCK_SECTOR_SIZE);
+          miss_cnt = 0;
+        }
+      if (block == NULL)
+        continue;
+
+      if (!miss)
+        cache_put (block);
+      else
+        {
+          if (miss_cnt == 0)
+            miss_start = sector + i;
+          misses[miss_cnt++] = block;
+          if (miss_cnt == RANGE_MAX)
+            {
+              fill_misses (misses, miss_cnt, miss_start,
+                           buffer + (miss_start - sector) * BLOCK_SECTOR_SIZE);
+              miss_cnt = 0;
+            }
+        }
+      i++;
+    }
+  if (miss_cnt > 0)
+    fill_misses (misses, miss_cnt, miss_start,
+                 buffer + (miss_start - sector) * BLOCK_SECTOR_SIZE);
+}
+
+/* Writes the CNT consecutive sectors starting at SECTOR from
+   BUFFER into the cache.  Every sector is overwritten whole, so
+   none of them is read from disk first. */
+void
+cache_write_range (block_sector_t sector, size_t cnt, const void *buffer_)
+{
+  const uint8_t *buffer = buffer_;
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    {
+      struct cache_entry *block;
+
+      block = cache_acquire (sector + i, CACHE_EXCLUSIVE, 0, NULL);
+      memcpy (block->data, buffer + i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE);
+      cache_mark_dirty (block);
+      cache_put (block);
+    }
+}
+
+/* Completes a read-ahead started by cache_readahead(). */
+static void
+readahead_done (struct block_request *r)
+{
+  cache_put (r->aux);
+}
+
+/* Starts reading SECTOR into the cache in the background and
+   returns without waiting for it.  Does nothing if SECTOR is
+   already cached, read-ahead is disabled, or no entry is free.
+   Until the read completes its entry is held CACHE_EXCLUSIVE, so
+   anyone who asks for SECTOR meanwhile waits for the data. */
+void cache_readahead (block_sector_t sector)
+{
   struct cache_entry *block;
 
-  for (int i = 0; i < size; i++) {
-    block = &blocks[i];
-    if (block->dirty) {
-      lock_acquire (&block->lox);
-      block_write (fs_device, block->sector, block->data);
+  if (cache_readahead_window == 0)
+    return;
+
+  block = cache_acquire (sector, CACHE_EXCLUSIVE,
+                         ACQUIRE_PREFETCH | ACQUIRE_NOWAIT, NULL);
+  if (block == NULL)
+    return;
+  block_request_init (&block->io, BLOCK_READ, sector, 1, block->data,
+                      readahead_done, block);
+  block_submit (fs_device, &block->io);
+}
+
+void cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Copies SIZE bytes from BUFFER into SECTOR starting at byte OFS,
+   straight into the cache entry.  The rest of the sector is read
+   from disk first only if the write does not cover all of it. */
+void
+cache_write_at (block_sector_t sector, const void *buffer, off_t ofs,
+                off_t size)
+{
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  bool whole = ofs == 0 && size == BLOCK_SECTOR_SIZE;
+  struct cache_entry *block = cache_acquire (sector, CACHE_EXCLUSIVE,
+                                             whole ? 0 : ACQUIRE_LOAD, NULL);
+  memcpy (block->data + ofs, buffer, size);
+  cache_mark_dirty (block);
+  cache_put (block);
+}
+
+static int
+compare_dirty (const void *a_, const void *b_)
+{
+  const struct dirty_block *a = a_;
+  const struct dirty_block *b = b_;
+  return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+/* Writes every dirty entry back to disk in ascending sector order,
+   so the disk sees one sweep instead of random seeks.  Entries are
+   collected one shard at a time, then all of their writes are
+   queued with the device at once and waited for together.  Each is
+   held CACHE_SHARED while it is written, so readers are not held
+   up; an entry that was cleaned or reused in the meantime is
+   skipped.  So is one that someone holds CACHE_EXCLUSIVE, which is
+   left for the next pass: waiting for it while holding the entries
+   already queued could deadlock with a thread that holds it and
+   wants one of those.  Returns the number of entries skipped that
+   way. */
+static size_t
+cache_write_behind (void)
+{
+  struct dirty_block *dirty = dirty_blocks;
+  struct cache_shard *shard;
+  size_t busy_cnt = 0;
+  int dirty_cnt = 0;
+  int i;
+
+  lock_acquire (&write_behind_lock);
+
+  for (shard = shards; shard < shards + CACHE_SHARD_CNT; shard++)
+    {
+      shard_lock (shard);
+      for (i = 0; i < shard->blocks_used; i++)
+        if (shard->blocks[i].dirty)
+          {
+            dirty[dirty_cnt].block = &shard->blocks[i];
+            dirty[dirty_cnt].sector = shard->blocks[i].sector;
+            dirty_cnt++;
+          }
+      lock_release (&shard->lock);
+    }
+
+  qsort (dirty, dirty_cnt, sizeof *dirty, compare_dirty);
+
+  for (i = 0; i < dirty_cnt; i++)
+    {
+      struct cache_entry *block = dirty[i].block;
+
+      shard = block->shard;
+      shard_lock (shard);
+      if (block->dirty && block->sector == dirty[i].sector
+          && !block->writer)
+        {
+          entry_acquire (block, CACHE_SHARED);
+          block_request_init (&block->io, BLOCK_WRITE, block->sector, 1,
+                              block->data, NULL, NULL);
+          block_submit (fs_device, &block->io);
+        }
+      else
+        {
+          if (block->dirty && block->sector == dirty[i].sector)
+            busy_cnt++;
+          dirty[i].block = NULL;
+        }
+      lock_release (&shard->lock);
+    }
+
+  for (i = 0; i < dirty_cnt; i++)
+    {
+      struct cache_entry *block = dirty[i].block;
+
+      if (block == NULL)
+        continue;
+      block_wait (&block->io);
+      shard = block->shard;
+      shard_lock (shard);
+      shard->stats.writebacks++;
       block->dirty = 0;
-      lock_release (&block->lox);
+      entry_release (block);
+      lock_release (&shard->lock);
     }
-  }
-  lock_release (&clock_lock);
+  lock_release (&write_behind_lock);
+  return busy_cnt;
+}
+
+/* Writes every dirty entry back to disk.  Entries that are held
+   CACHE_EXCLUSIVE are retried until their holders let go, so none
+   is left behind at shutdown. */
+void cache_flush (void) {
+  while (cache_write_behind () > 0)
+    timer_msleep (1);
 }
 
+/* Stores the sum of every shard's statistics into STATS. */
+void
+cache_get_stats (struct cache_stats *stats)
+{
+  struct cache_shard *shard;
 
+  memset (stats, 0, sizeof *stats);
+  for (shard = shards; shard < shards + CACHE_SHARD_CNT; shard++)
+    {
+      shard_lock (shard);
+      stats->hits += shard->stats.hits;
+      stats->misses += shard->stats.misses;
+      stats->evictions += shard->stats.evictions;
+      stats->writebacks += shard->stats.writebacks;
+      stats->readahead_hits += shard->stats.readahead_hits;
+      stats->readahead_wasted += shard->stats.readahead_wasted;
+      stats->lock_waits += shard->stats.lock_waits;
+      stats->lock_wait_usecs += shard->stats.lock_wait_usecs;
+      lock_release (&shard->lock);
+    }
+}
 
+/* Prints buffer cache statistics for the file system device. */
+void
+cache_print_stats (void)
+{
+  struct cache_stats stats;
 
+  if (fs_device == NULL)
+    return;
 
+  cache_get_stats (&stats);
+  printf ("%s (cache): %llu hits, %llu misses, %llu evictions, "
+          "%llu writebacks\n",
+          block_name (fs_device), stats.hits, stats.misses,
+          stats.evictions, stats.writebacks);
+  printf ("%s (cache): %llu read-ahead hits, %llu read-ahead wasted, "
+          "%llu lock waits (%llu us)\n",
+          block_name (fs_device), stats.readahead_hits,
+          stats.readahead_wasted, stats.lock_waits, stats.lock_wait_usecs);
+}
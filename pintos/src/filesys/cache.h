@@ -1,12 +1,64 @@
 #ifndef FILESYS_CACHE_H
 #define FILESYS_CACHE_H
 
+#include <stdbool.h>
+#include <cache-stats.h>
 #include "devices/block.h"
+#include "filesys/off_t.h"
 
+/* Buffer cache replacement policies. */
+enum cache_policy
+  {
+    CACHE_POLICY_CLOCK,         /* Second-chance clock. */
+    CACHE_POLICY_2Q             /* Scan-resistant 2Q. */
+  };
+
+/* Replacement policy in use.
+   Controlled by kernel command-line option "-cache-policy". */
+extern enum cache_policy cache_policy;
+
+/* Number of sectors cached, or if cache_size_pct is nonzero, the
+   percentage of the kernel page pool to use instead.
+   Controlled by kernel command-line option "-cache". */
+extern size_t cache_size;
+extern unsigned cache_size_pct;
+
+/* Milliseconds between write-behind passes (0 to disable).
+   Controlled by kernel command-line option "-flush". */
+extern unsigned cache_flush_msecs;
+
+/* Sectors to read ahead of a sequential reader (0 to disable).
+   Controlled by kernel command-line option "-ra". */
+extern unsigned cache_readahead_window;
+
+/* Access modes for cache_get(). */
+enum cache_mode
+  {
+    CACHE_SHARED,               /* Read-only, shared with other readers. */
+    CACHE_EXCLUSIVE             /* Read-write, no other holders. */
+  };
+
+struct cache_entry;
 
 void cache_init (void);
+bool cache_set_policy (const char *name);
+bool cache_set_size (const char *value);
+struct cache_entry *cache_get (block_sector_t sector, enum cache_mode);
+void *cache_data (struct cache_entry *);
+void cache_mark_dirty (struct cache_entry *);
+void cache_put (struct cache_entry *);
 void cache_read (block_sector_t sector, void * buffer);
 void cache_write (block_sector_t sector, const void * buffer);
+void cache_read_at (block_sector_t sector, void *buffer, off_t ofs,
+                    off_t size);
+void cache_write_at (block_sector_t sector, const void *buffer, off_t ofs,
+                     off_t size);
+void cache_read_range (block_sector_t sector, size_t cnt, void *buffer);
+void cache_write_range (block_sector_t sector, size_t cnt,
+                        const void *buffer);
+void cache_readahead (block_sector_t sector);
 void cache_flush (void);
+void cache_get_stats (struct cache_stats *);
+void cache_print_stats (void);
 
-#endif /* filesys/block.h */
\ No newline at end of file
+#endif /* filesys/cache.h */
\ No newline at end of file
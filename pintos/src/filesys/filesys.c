@@ -23,11 +23,13 @@ static char *relative_path(char *path);
 void
 filesys_init (bool format)
 {
+  /* The write-behind thread starts flushing inodes as soon as
+     fs_device is set. */
+  inode_init ();
   fs_device = block_get_role (BLOCK_FILESYS);
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
-  inode_init ();
   free_map_init ();
 
   if (format)
@@ -43,6 +45,7 @@ filesys_init (bool format)
 void
 filesys_done (void)
 {
+  inode_flush ();
   cache_flush();
   free_map_close ();
 }
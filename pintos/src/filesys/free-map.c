@@ -47,6 +47,57 @@ free_map_allocate (size_t cnt, block_sector_t *sectorp)
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates CNT sectors and stores their numbers into SECTORS, in
+   as few runs of consecutive sectors as the free map allows.  The
+   search for each run starts at GOAL, or right after the previous
+   run, so that a file grown in several steps can stay contiguous;
+   when no run of the remaining size is free, ever smaller runs are
+   taken.  The free map is written out once for the whole
+   allocation.
+   Returns true if successful, false if fewer than CNT sectors are
+   free or if the free_map file could not be written, in which case
+   nothing is allocated. */
+bool
+free_map_allocate_runs (size_t cnt, block_sector_t *sectors,
+                        block_sector_t goal)
+{
+  size_t done = 0;
+  size_t run = cnt;
+  bool success = false;
+
+  lock_acquire (&fm_lock);
+  if (bitmap_count (free_map, 0, bitmap_size (free_map), false) >= cnt)
+    {
+      while (done < cnt)
+        {
+          size_t want = run < cnt - done ? run : cnt - done;
+          size_t start = bitmap_scan (free_map, goal, want, false);
+          size_t i;
+
+          if (start == BITMAP_ERROR && goal != 0)
+            start = bitmap_scan (free_map, 0, want, false);
+          if (start == BITMAP_ERROR)
+            {
+              run = want / 2;
+              continue;
+            }
+
+          bitmap_set_multiple (free_map, start, want, true);
+          for (i = 0; i < want; i++)
+            sectors[done++] = start + i;
+          goal = start + want;
+        }
+
+      success = (free_map_file == NULL
+                 || bitmap_write (free_map, free_map_file));
+      if (!success)
+        for (done = 0; done < cnt; done++)
+          bitmap_reset (free_map, sectors[done]);
+    }
+  lock_release (&fm_lock);
+  return success;
+}
+
 bool
 fm_allocate (size_t cnt, block_sector_t *sectorp)
 {
@@ -12,6 +12,8 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_runs (size_t cnt, block_sector_t *sectors,
+                             block_sector_t goal);
 void free_map_release (block_sector_t, size_t);
 bool fm_allocate (size_t cnt, block_sector_t *sectorp);
 void fm_release (block_sector_t *sectors, size_t cnt);
@@ -1,26 +1,108 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
 #include <string.h>
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 #include <stdlib.h>
 #include "filesys/cache.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
-#define DIRECT_SIZE 122
+#define DIRECT_SIZE 121
+
+/* Sector pointers in an indirect block. */
+#define PTRS_PER_BLOCK 128
+
+/* Data sectors a block-mapped inode can address: its direct
+   sectors plus those below its indirect, doubly indirect and
+   triply indirect blocks, about 1 GB in all. */
+#define MAX_SECTORS (DIRECT_SIZE + PTRS_PER_BLOCK \
+                     + PTRS_PER_BLOCK * PTRS_PER_BLOCK \
+                     + PTRS_PER_BLOCK * PTRS_PER_BLOCK * PTRS_PER_BLOCK)
+
+/* Bytes of data that fit in the inode itself, in place of the
+   block pointers. */
+#define INLINE_SIZE ((DIRECT_SIZE + 3) * sizeof (block_sector_t))
+
+/* File sectors map_holes() allocates with one free map operation. */
+#define EXTEND_BATCH 1024
+
+/* Indirect blocks, at any level, that one batch of EXTEND_BATCH
+   file sectors can need: a last-level block for each
+   PTRS_PER_BLOCK sectors, plus one where the batch starts partway
+   into one, and at most 3 blocks above them, as when a batch runs
+   from the doubly indirect tree into the triply indirect one. */
+#define BATCH_INDIRECT_MAX (EXTEND_BATCH / PTRS_PER_BLOCK + 1 + 3)
+
+/* Ways an inode_disk can map its data. */
+enum inode_layout
+  {
+    INODE_BLOCKS,                       /* Direct and indirect pointers. */
+    INODE_EXTENTS,                      /* Extent tree. */
+    INODE_INLINE                        /* Data in the inode itself. */
+  };
+
+/* A run of CNT sectors starting at START holding the file's
+   sectors LOGICAL...LOGICAL + CNT - 1.  In an interior node of an
+   extent tree, START is instead the sector of a child node whose
+   extents all begin at or after LOGICAL, and CNT is unused. */
+struct extent
+  {
+    uint32_t logical;                   /* First file sector covered. */
+    uint32_t cnt;                       /* Number of sectors. */
+    block_sector_t start;               /* First disk sector. */
+  };
+
+/* Header of a node of an extent tree.  The node's extents follow
+   it, sorted by LOGICAL. */
+struct extent_header
+  {
+    uint16_t cnt;                       /* Number of extents in use. */
+    uint16_t depth;                     /* 0 for a leaf. */
+  };
+
+/* Extents that fit in the root node in the inode and in a node
+   of its own sector. */
+#define EXTENT_ROOT_CNT 41
+#define EXTENT_NODE_CNT 42
+
+/* Root of an extent tree, overlaying the block pointers. */
+struct extent_root
+  {
+    struct extent_header header;
+    struct extent extents[EXTENT_ROOT_CNT];
+  };
+
+/* Extent tree node in a sector of its own. */
+struct extent_node
+  {
+    struct extent_header header;
+    struct extent extents[EXTENT_NODE_CNT];
+    uint32_t unused;
+  };
 
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk {
-  block_sector_t direct[DIRECT_SIZE];  
-  block_sector_t indirect;              
-  block_sector_t doubly_indirect;       
+  union
+    {
+      struct
+        {
+          block_sector_t direct[DIRECT_SIZE];  
+          block_sector_t indirect;              
+          block_sector_t doubly_indirect;       
+          block_sector_t triple_indirect;   /* 0 until first needed. */
+        };
+      struct extent_root extents;       /* If LAYOUT is INODE_EXTENTS. */
+      uint8_t inline_data[INLINE_SIZE]; /* If LAYOUT is INODE_INLINE. */
+    };
   bool directory;                           
+  uint8_t layout;                       /* An enum inode_layout. */
   block_sector_t parent_node;			    
     
   off_t length;                             /* File size in bytes. */
@@ -36,59 +118,420 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/* Create new inodes with an extent tree.  See inode.h. */
+bool inode_use_extents;
+
 /* In-memory inode. */
 struct inode
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
-    // struct inode_disk data;             /* Inode content. */
+    off_t read_next;                    /* Offset a sequential read resumes at. */
+    off_t readahead_end;                /* End of sectors already read ahead. */
+    struct lock lock;                   /* Guards changes to DATA and DIRTY. */
+    unsigned map_seq;                   /* Odd while the mapping changes. */
+    bool dirty;                         /* DATA differs from the disk copy. */
+    struct inode_disk data;             /* Inode content. */
   };
 
 
+/* Returns entry IDX of the indirect block at SECTOR, reading it
+   in place in the cache. */
+static block_sector_t
+indirect_lookup (block_sector_t sector, off_t idx)
+{
+  struct cache_entry *e = cache_get (sector, CACHE_SHARED);
+  block_sector_t ptr = ((const block_sector_t *) cache_data (e))[idx];
+  cache_put (e);
+  return ptr;
+}
+
+/* Returns the extents of the extent tree node with header H. */
+static inline struct extent *
+node_extents (const struct extent_header *h)
+{
+  return (struct extent *) (h + 1);
+}
+
+/* Returns the last extent in node H whose first logical sector is
+   at most IDX, or a null pointer if there is none. */
+static struct extent *
+extent_find (const struct extent_header *h, uint32_t idx)
+{
+  struct extent *extents = node_extents (h);
+  size_t lo = 0, hi = h->cnt;
+
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (extents[mid].logical <= idx)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo > 0 ? &extents[lo - 1] : NULL;
+}
+
+/* Returns the disk sector holding file sector IDX in the extent
+   tree with root node ROOT, or 0 if IDX lies in a hole.  If RUN is
+   nonnull, stores in *RUN the number of sectors from IDX to the end
+   of its extent, all of which are consecutive on disk. */
+static block_sector_t
+extent_lookup (const struct extent_header *root, uint32_t idx, size_t *run)
+{
+  const struct extent_header *h = root;
+  struct cache_entry *e = NULL;
+  block_sector_t sector = 0;
+
+  for (;;)
+    {
+      const struct extent *x = extent_find (h, idx);
+      block_sector_t child;
+
+      if (x == NULL)
+        break;
+      if (h->depth == 0)
+        {
+          if (idx < x->logical + x->cnt)
+            {
+              sector = x->start + (idx - x->logical);
+              if (run != NULL)
+                *run = x->logical + x->cnt - idx;
+            }
+          break;
+        }
+
+      child = x->start;
+      if (e != NULL)
+        cache_put (e);
+      e = cache_get (child, CACHE_SHARED);
+      h = cache_data (e);
+    }
+  if (e != NULL)
+    cache_put (e);
+  return sector;
+}
+
+/* Returns true if extent X continues PREV both in the file and on
+   disk, so that PREV can simply be lengthened to cover it. */
+static inline bool
+extent_continues (const struct extent *prev, const struct extent *x)
+{
+  return (prev != NULL
+          && prev->logical + prev->cnt == x->logical
+          && prev->start + prev->cnt == x->start);
+}
+
+/* Inserts X into node H at index POS, which must have room. */
+static void
+extent_add (struct extent_header *h, size_t pos, struct extent x)
+{
+  struct extent *extents = node_extents (h);
+
+  memmove (&extents[pos + 1], &extents[pos],
+           (h->cnt - pos) * sizeof *extents);
+  extents[pos] = x;
+  h->cnt++;
+}
+
+/* Inserts X into the subtree rooted at node H, which has room for
+   MAX extents, merging it into the preceding extent if the two are
+   adjacent both in the file and on disk.  If H is full, it is split
+   and the interior-node extent for its new right sibling is stored
+   in *SPLIT; otherwise SPLIT->start is set to 0, which is never a
+   node's sector.  The root is never split: extent_insert() makes
+   sure it has room first.  Returns false if a new node could not be
+   allocated. */
+static bool
+extent_insert_node (struct extent_header *h, size_t max, struct extent x,
+                    struct extent *split)
+{
+  struct extent *extents = node_extents (h);
+  struct extent *prev = extent_find (h, x.logical);
+  size_t pos = prev != NULL ? prev - extents + 1 : 0;
+  struct extent_node *sibling;
+  size_t half;
+
+  split->start = 0;
+  if (h->depth > 0)
+    {
+      /* Insert into the child covering X, then add its new sibling,
+         if any, to this node. */
+      struct extent *child = &extents[pos > 0 ? pos - 1 : 0];
+      struct cache_entry *e = cache_get (child->start, CACHE_EXCLUSIVE);
+      bool ok = extent_insert_node (cache_data (e), EXTENT_NODE_CNT, x,
+                                    split);
+      cache_mark_dirty (e);
+      cache_put (e);
+
+      if (x.logical < child->logical)
+        child->logical = x.logical;
+      if (!ok || split->start == 0)
+        return ok;
+      x = *split;
+      pos = child - extents + 1;
+      split->start = 0;
+    }
+  else if (extent_continues (prev, &x))
+    {
+      prev->cnt += x.cnt;
+      return true;
+    }
+
+  if (h->cnt < max)
+    {
+      extent_add (h, pos, x);
+      return true;
+    }
+
+  /* Move the upper half of this node into a new sibling. */
+  sibling = calloc (1, sizeof *sibling);
+  if (sibling == NULL)
+    return false;
+  if (!free_map_allocate (1, &split->start))
+    {
+      split->start = 0;
+      free (sibling);
+      return false;
+    }
+  half = h->cnt / 2;
+  sibling->header.depth = h->depth;
+  sibling->header.cnt = h->cnt - half;
+  memcpy (sibling->extents, &extents[half],
+          sibling->header.cnt * sizeof *extents);
+  h->cnt = half;
+  if (pos > half)
+    extent_add (&sibling->header, pos - half, x);
+  else
+    extent_add (h, pos, x);
+
+  split->logical = sibling->extents[0].logical;
+  split->cnt = 0;
+  cache_write (split->start, sibling);
+  free (sibling);
+  return true;
+}
+
+/* Inserts X into the extent tree of DATA.  If the root is full,
+   its extents move to a new node and the tree grows one level.
+   Returns false if a new node could not be allocated. */
+static bool
+extent_insert (struct inode_disk *data, struct extent x)
+{
+  struct extent_header *root = &data->extents.header;
+  struct extent *extents = node_extents (root);
+  struct extent_node *child;
+  struct extent split;
+  block_sector_t sector;
+
+  /* A root with room can take X, or the one extent that a split
+     child adds. */
+  if (root->cnt < EXTENT_ROOT_CNT
+      || (root->depth == 0
+          && extent_continues (extent_find (root, x.logical), &x)))
+    return extent_insert_node (root, EXTENT_ROOT_CNT, x, &split);
+
+  /* The root is full: push its extents down into a new node. */
+  child = calloc (1, sizeof *child);
+  if (child == NULL)
+    return false;
+  if (!free_map_allocate (1, &sector))
+    {
+      free (child);
+      return false;
+    }
+  child->header = *root;
+  memcpy (child->extents, extents, root->cnt * sizeof *extents);
+  cache_write (sector, child);
+  free (child);
+
+  root->depth++;
+  root->cnt = 1;
+  extents[0].logical = 0;
+  extents[0].cnt = 0;
+  extents[0].start = sector;
+  return extent_insert_node (root, EXTENT_ROOT_CNT, x, &split);
+}
+
+/* Sectors of zeros for initializing newly allocated sectors. */
+#define ZERO_CNT 8
+static const uint8_t zeros[ZERO_CNT * BLOCK_SECTOR_SIZE];
+
+/* Writes zeros to the CNT sectors starting at SECTOR. */
+static void
+zero_sectors (block_sector_t sector, size_t cnt)
+{
+  while (cnt > 0)
+    {
+      size_t n = cnt < ZERO_CNT ? cnt : ZERO_CNT;
+      cache_write_range (sector, n, zeros);
+      sector += n;
+      cnt -= n;
+    }
+}
+
+/* Returns the number of sectors at the start of the CNT sectors
+   in SECTORS that are consecutive on disk. */
+static size_t
+run_length (const block_sector_t *sectors, size_t cnt)
+{
+  size_t n = 1;
+
+  while (n < cnt && sectors[n] == sectors[0] + n)
+    n++;
+  return n;
+}
+
+/* Releases the extents of the subtree rooted at node H, and every
+   node below it. */
+static void
+extent_release (const struct extent_header *h)
+{
+  const struct extent *x;
+
+  for (x = node_extents (h); x < node_extents (h) + h->cnt; x++)
+    if (h->depth == 0)
+      free_map_release (x->start, x->cnt);
+    else
+      {
+        struct extent_node *child = malloc (sizeof *child);
+        if (child == NULL)
+          continue;
+        cache_read (x->start, child);
+        extent_release (&child->header);
+        free_map_release (x->start, 1);
+        free (child);
+      }
+}
+
 block_sector_t
 sector_ptr ( const struct inode *inode) {
   return inode->sector;
 }
 
+/* Returns the number of file sectors mapped by a block pointer at
+   LEVEL: 1 for a data sector, PTRS_PER_BLOCK for an indirect block,
+   and so on. */
+static size_t
+level_span (int level)
+{
+  size_t span = 1;
+
+  while (level-- > 0)
+    span *= PTRS_PER_BLOCK;
+  return span;
+}
+
+/* Returns the pointer in block-mapped DATA to the indirect,
+   doubly indirect or triply indirect block whose tree maps file
+   sector *IDX, which must be past the direct sectors.  Makes *IDX
+   relative to the start of that tree and stores its height, from 1
+   to 3, in *LEVEL.  Returns a null pointer if *IDX is past
+   MAX_SECTORS. */
+static block_sector_t *
+indirect_root (const struct inode_disk *data_, size_t *idx, int *level)
+{
+  struct inode_disk *data = (struct inode_disk *) data_;
+  block_sector_t *roots[] = {&data->indirect, &data->doubly_indirect,
+                             &data->triple_indirect};
+
+  *idx -= DIRECT_SIZE;
+  for (*level = 1; *level <= 3; (*level)++)
+    {
+      if (*idx < level_span (*level))
+        return roots[*level - 1];
+      *idx -= level_span (*level);
+    }
+  return NULL;
+}
+
+/* Returns the disk sector holding file sector IDX of block-mapped
+   DATA, or 0 if it has none. */
+static block_sector_t
+block_lookup (const struct inode_disk *data, size_t idx)
+{
+  block_sector_t *root;
+  block_sector_t sector;
+  int level;
+
+  if (idx < DIRECT_SIZE)
+    return data->direct[idx];
+
+  root = indirect_root (data, &idx, &level);
+  if (root == NULL)
+    return 0;
+  for (sector = *root; sector != 0 && level-- > 0; )
+    sector = indirect_lookup (sector, idx / level_span (level)
+                                      % PTRS_PER_BLOCK);
+  return sector;
+}
+
+/* Returns the disk sector holding file sector IDX of INODE, or 0
+   if IDX lies in a hole, without holding INODE's lock.  If RUN is
+   nonnull and INODE is extent-mapped, stores in *RUN the number of
+   consecutive sectors from IDX to the end of its extent.
+
+   A block-mapped inode's pointers change one word at a time, but
+   the root of an extent tree changes in several steps.  Its
+   lookup works on a copy of the root and succeeds only if MAP_SEQ
+   shows that no writer changed the tree meanwhile; otherwise it is
+   redone under INODE's lock, after the writer is done. */
+static block_sector_t
+inode_lookup (struct inode *inode, size_t idx, size_t *run)
+{
+  struct extent_root root;
+  unsigned seq;
+  block_sector_t sector;
+
+  if (inode->data.layout != INODE_EXTENTS)
+    return block_lookup (&inode->data, idx);
+
+  seq = inode->map_seq;
+  barrier ();
+  if (seq % 2 == 0)
+    {
+      root = inode->data.extents;
+      barrier ();
+      if (inode->map_seq == seq)
+        {
+          sector = extent_lookup (&root.header, idx, run);
+          barrier ();
+          if (inode->map_seq == seq)
+            return sector;
+        }
+    }
+
+  lock_acquire (&inode->lock);
+  sector = extent_lookup (&inode->data.extents.header, idx, run);
+  lock_release (&inode->lock);
+  return sector;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
-byte_to_sector (const struct inode *inode, off_t pos)
+byte_to_sector (struct inode *inode, off_t pos)
 {
   ASSERT (inode != NULL);
 
-  char buf[BLOCK_SECTOR_SIZE];
-  cache_read(inode->sector, &buf);
-  struct inode_disk *data = (struct inode_disk*) buf;
-
-  if (pos < data->length && pos >= 0 ) {
-  	off_t idx = pos / BLOCK_SECTOR_SIZE;
-  	if (idx < DIRECT_SIZE) {
-  		return data->direct[idx];
-
-  	} else if (idx < DIRECT_SIZE + 128) {
-  		block_sector_t buffer[128] = {0};
-  		cache_read(data->indirect, buffer);
-  		idx -= DIRECT_SIZE;
-  		return buffer[idx];
-
-  	} else if (idx < DIRECT_SIZE + 128 * 128){
-  		block_sector_t buffer[128] = {0};
-  		idx -= DIRECT_SIZE + 128;
-  		cache_read(data->doubly_indirect, buffer);
-  		block_sector_t sector = buffer[idx/128];
-  		cache_read(sector, buffer);
-  		return buffer[idx % 128];
-  	} else {
-  		return -1;
-  	}
+  const struct inode_disk *data = &inode->data;
+  off_t idx = pos / BLOCK_SECTOR_SIZE;
+
+  if (pos >= data->length || pos < 0) {
+    return -1;
+  }
+
+  if (data->layout == INODE_EXTENTS) {
+    return inode_lookup (inode, idx, NULL);
+  } else if (idx < MAX_SECTORS) {
+    return block_lookup (data, idx);
   } else {
-  	return -1;
+    return -1;
   }
 }
 
@@ -96,28 +539,152 @@ struct indirect_block {
 	block_sector_t block_ptrs[128];
 };
 
-bool
-indirect_blocker(struct indirect_block *block, off_t start, off_t stop) {
-	static char buf[BLOCK_SECTOR_SIZE];
-	for (int i = start; i <= stop; i++) {
-		if (!free_map_allocate(1, &block->block_ptrs[i])) {
-			return false;
-		}
-		cache_write(block->block_ptrs[i], buf);
-	}
-	
-	return true;
-}
-
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Stores the CNT sector numbers in SECTORS into entries FIRST
+   onward of the indirect block at BLOCK. */
+static void
+indirect_store (block_sector_t block, size_t first,
+                const block_sector_t *sectors, size_t cnt)
+{
+  struct cache_entry *e = cache_get (block, CACHE_EXCLUSIVE);
+
+  memcpy ((block_sector_t *) cache_data (e) + first, sectors,
+          cnt * sizeof *sectors);
+  cache_mark_dirty (e);
+  cache_put (e);
+}
+
+/* Returns the number of indirect blocks, at any level, that
+   block-mapped DATA lacks for file sectors FIRST...FIRST + CNT - 1. */
+static size_t
+missing_indirect_blocks (const struct inode_disk *data, size_t first,
+                         size_t cnt)
+{
+  size_t start = first > DIRECT_SIZE ? first : DIRECT_SIZE;
+  size_t missing = 0;
+  size_t idx;
+
+  /* Visit the last-level indirect block of each run of
+     PTRS_PER_BLOCK sectors in the range.  A missing block is counted
+     where the range first reaches it: at the first sector visited or
+     at the block's own first sector. */
+  for (idx = start; idx < first + cnt; )
+    {
+      size_t rel = idx;
+      int level;
+      block_sector_t *root = indirect_root (data, &rel, &level);
+      block_sector_t block;
+
+      if (root == NULL)
+        break;
+      for (block = *root; level > 0; level--)
+        {
+          if (block == 0)
+            {
+              for (; level > 0; level--)
+                if (idx == start || rel % level_span (level) == 0)
+                  missing++;
+              break;
+            }
+          if (level > 1)
+            block = indirect_lookup (block, rel / level_span (level - 1)
+                                            % PTRS_PER_BLOCK);
+        }
+      idx += PTRS_PER_BLOCK - rel % PTRS_PER_BLOCK;
+    }
+  return missing;
+}
+
+/* Returns a newly allocated indirect block, taken from the array
+   *INDIRECT, which is advanced past it, and zeroed. */
+static block_sector_t
+new_indirect_block (const block_sector_t **indirect)
+{
+  block_sector_t block = *(*indirect)++;
+
+  cache_write (block, zeros);
+  return block;
+}
+
+/* Points file sectors FIRST...FIRST + CNT - 1 of block-mapped DATA
+   at the sectors in SECTORS, taking any indirect blocks that must
+   be added from the array *INDIRECT, which is advanced past them. */
+static void
+block_map (struct inode_disk *data, size_t first,
+           const block_sector_t *sectors, size_t cnt,
+           const block_sector_t **indirect)
+{
+  size_t i = 0;
+
+  while (i < cnt)
+    {
+      size_t idx = first + i;
+      block_sector_t *root;
+      block_sector_t block;
+      int level;
+      size_t n;
+
+      if (idx < DIRECT_SIZE)
+        {
+          data->direct[idx] = sectors[i++];
+          continue;
+        }
+
+      /* Find the last-level indirect block for IDX, adding any
+         missing blocks on the way down. */
+      root = indirect_root (data, &idx, &level);
+      ASSERT (root != NULL);
+      if (*root == 0)
+        *root = new_indirect_block (indirect);
+      for (block = *root; level > 1; level--)
+        {
+          size_t k = idx / level_span (level - 1) % PTRS_PER_BLOCK;
+          block_sector_t child = indirect_lookup (block, k);
+
+          if (child == 0)
+            {
+              child = new_indirect_block (indirect);
+              indirect_store (block, k, &child, 1);
+            }
+          block = child;
+        }
+
+      idx %= PTRS_PER_BLOCK;
+      n = PTRS_PER_BLOCK - idx;
+      if (n > cnt - i)
+        n = cnt - i;
+      indirect_store (block, idx, sectors + i, n);
+      i += n;
+    }
+}
+
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  OPEN_INODES_LOCK guards
+   the table, LOOKUP_KEY and every inode's open_cnt. */
+static struct hash open_inodes;
+static struct lock open_inodes_lock;
+static struct inode lookup_key;
+
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("out of memory for open inode table");
+  lock_init (&open_inodes_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -145,7 +712,12 @@ inode_create (block_sector_t sector, off_t length, bool isdir)
       disk_inode->directory = isdir;
       disk_inode->magic = INODE_MAGIC;
 
-  	  success = fm_allo(disk_inode) && inode_extend(disk_inode, length);
+      /* Small files start out with their data in the inode. */
+      if (length <= (off_t) INLINE_SIZE)
+        disk_inode->layout = INODE_INLINE;
+      else
+        disk_inode->layout = inode_use_extents ? INODE_EXTENTS : INODE_BLOCKS;
+  	  success = inode_extend(disk_inode, length);
 
   	  cache_write(sector, disk_inode);
       free (disk_inode);
@@ -154,158 +726,260 @@ inode_create (block_sector_t sector, off_t length, bool isdir)
   return success;
 }
 
+/* Releases BLOCK, which holds data if LEVEL is 0 or else points
+   to blocks of level LEVEL - 1, and every block below it.  Does
+   nothing if BLOCK is 0, a hole. */
+static void
+indirect_release (block_sector_t block, int level)
+{
+  if (block == 0)
+    return;
+  if (level > 0)
+    {
+      struct indirect_block *ptrs = malloc (sizeof *ptrs);
+      if (ptrs != NULL)
+        {
+          size_t i;
+
+          cache_read (block, ptrs);
+          for (i = 0; i < PTRS_PER_BLOCK; i++)
+            indirect_release (ptrs->block_ptrs[i], level - 1);
+          free (ptrs);
+        }
+    }
+  free_map_release (block, 1);
+}
+
+/* Releases every sector mapped by INODE, including its indirect
+   blocks, but not the inode sector itself. */
 bool
-fm_allo(struct inode_disk *data) {
-	static char buf[BLOCK_SECTOR_SIZE];
+inode_dealloc(struct inode *inode) {
+  struct inode_disk *data = &inode->data;
+  size_t i;
+
+  if (data->layout == INODE_INLINE) {
+    return true;
+  } else if (data->layout == INODE_EXTENTS) {
+    extent_release (&data->extents.header);
+    return true;
+  }
 
-	if (!free_map_allocate(1, &data->indirect)) {
-		return false;
-	}
-	cache_write(data->indirect, buf);
+  for (i = 0; i < DIRECT_SIZE; i++)
+    indirect_release (data->direct[i], 0);
+  indirect_release (data->indirect, 1);
+  indirect_release (data->doubly_indirect, 2);
+  indirect_release (data->triple_indirect, 3);
+  return true;
+}
 
-	if (!free_map_allocate(1, &data->doubly_indirect)) {
-		return false;
-	}
-	cache_write(data->doubly_indirect, buf);
+/* Returns true if DATA can be LENGTH bytes long. */
+static bool
+length_fits (const struct inode_disk *data, off_t length)
+{
+  return (length >= 0
+          && (data->layout == INODE_EXTENTS
+              || bytes_to_sectors (length) <= MAX_SECTORS));
+}
 
-	return true;
+/* Returns the disk sector holding file sector IDX of DATA, or 0 if
+   IDX lies in a hole. */
+static block_sector_t
+sector_lookup (const struct inode_disk *data, size_t idx)
+{
+  if (data->layout == INODE_EXTENTS)
+    return extent_lookup (&data->extents.header, idx, NULL);
+  else
+    return block_lookup (data, idx);
 }
 
+/* Allocates sectors for the holes among file sectors FIRST...FIRST
+   + CNT - 1 of DATA and maps them.  Each new sector is filled
+   before it is mapped, so that a concurrent reader never sees what
+   it held before: with the matching sector of SRC, which holds CNT
+   sectors of data for FIRST onward, or with zeros if SRC is null.
+   Sectors are allocated EXTEND_BATCH file sectors at a time, each
+   batch in one free map operation that starts looking right after
+   the sector before the first hole, so that a file written in
+   order stays contiguous on disk.  Sets *MAPPED to true if any
+   hole was filled.  Returns false if the disk is full; the holes
+   filled up to that point stay filled. */
+static bool
+map_holes (struct inode_disk *data, size_t first, size_t cnt,
+           const uint8_t *src, bool *mapped)
+{
+  const size_t src_first = first;
+  const size_t max_sectors = EXTEND_BATCH + BATCH_INDIRECT_MAX;
+  block_sector_t *sectors = NULL;
+  size_t *holes = NULL;
+  bool success = false;
 
-bool
-inode_dealloc(struct inode *inode) {
-	char buf[BLOCK_SECTOR_SIZE];
-    cache_read(inode->sector, &buf);
-    struct inode_disk *data = (struct inode_disk*) buf;
-
-	size_t cur = bytes_to_sectors(data->length);
-	size_t left = bytes_to_sectors(data->length);
-
-	fm_release(data->direct, DIRECT_SIZE);
-	left -= DIRECT_SIZE;
-	if (left <= 0) {
-		return true;
-	}
-
-	if (cur > DIRECT_SIZE + 128) {
-		struct indirect_block *inode_indirect = calloc(1, sizeof(struct indirect_block));
-		cache_read(data->indirect, inode_indirect);
-
-		fm_release( inode_indirect->block_ptrs, 128);
-		left -= 128;
-		free(inode_indirect);
-
-		if (left <= 0) {
-			fm_release(data->indirect, 128);
-			return true;
-		}
-	}
-
-	if (cur > DIRECT_SIZE + 128 + 128) {
-		struct indirect_block *doubly_indirect = calloc(1, sizeof(struct indirect_block));
-		cache_read(data->doubly_indirect, doubly_indirect);
-
-		for (off_t i = 0; i < 128; i++) {
-			struct indirect_block *inode_indirect = calloc(1, sizeof(struct indirect_block));
-			cache_read(doubly_indirect->block_ptrs[i], inode_indirect);
-
-			fm_release(inode_indirect->block_ptrs, 128);
-			left -= 128;
-			free(inode_indirect);
-
-			if (left <= 0) {
-				fm_release(data->doubly_indirect, 128);
-				free(doubly_indirect);
-				return true;
-			}
-			fm_release(doubly_indirect->block_ptrs, 128);
-		}
-	}
-	
-  return true;
+  while (cnt > 0)
+    {
+      size_t batch = cnt < EXTEND_BATCH ? cnt : EXTEND_BATCH;
+      size_t hole_cnt = 0, indirect_cnt = 0;
+      const block_sector_t *indirect;
+      block_sector_t goal;
+      size_t i, n;
+
+      /* Find the holes in this batch. */
+      for (i = first; i < first + batch; i++)
+        if (sector_lookup (data, i) == 0)
+          {
+            if (holes == NULL)
+              {
+                sectors = malloc (max_sectors * sizeof *sectors);
+                holes = malloc (EXTEND_BATCH * sizeof *holes);
+                if (sectors == NULL || holes == NULL)
+                  goto done;
+              }
+            holes[hole_cnt++] = i;
+          }
+      if (hole_cnt > 0)
+        {
+          /* Allocate sectors for them, plus any indirect blocks they
+             need. */
+          if (data->layout == INODE_BLOCKS)
+            indirect_cnt = missing_indirect_blocks (data, first, batch);
+          ASSERT (indirect_cnt + hole_cnt <= max_sectors);
+          goal = holes[0] > 0 ? sector_lookup (data, holes[0] - 1) + 1 : 0;
+          if (!free_map_allocate_runs (indirect_cnt + hole_cnt, sectors,
+                                       goal))
+            goto done;
+          indirect = sectors;
+          *mapped = true;
+
+          /* Map each run of holes that got consecutive sectors. */
+          for (i = 0; i < hole_cnt; i += n)
+            {
+              block_sector_t *run = sectors + indirect_cnt + i;
+
+              n = run_length (run, hole_cnt - i);
+              while (n > 1 && holes[i + n - 1] != holes[i] + n - 1)
+                n--;
+              if (src != NULL)
+                cache_write_range (run[0], n, src + ((holes[i] - src_first)
+                                                     * BLOCK_SECTOR_SIZE));
+              else
+                zero_sectors (run[0], n);
+
+              if (data->layout == INODE_BLOCKS)
+                block_map (data, holes[i], run, n, &indirect);
+              else
+                {
+                  struct extent x;
+
+                  x.logical = holes[i];
+                  x.cnt = n;
+                  x.start = run[0];
+                  if (!extent_insert (data, x))
+                    {
+                      for (; i < hole_cnt; i++)
+                        free_map_release (sectors[indirect_cnt + i], 1);
+                      goto done;
+                    }
+                }
+            }
+          ASSERT (indirect == sectors + indirect_cnt);
+        }
+
+      first += batch;
+      cnt -= batch;
+    }
+  success = true;
+
+ done:
+  free (sectors);
+  free (holes);
+  return success;
 }
 
+/* Calls map_holes() on the resident inode_disk of INODE, whose
+   lock must be held, with MAP_SEQ odd meanwhile so that
+   inode_lookup() knows not to trust what it reads. */
+static bool
+inode_map_holes (struct inode *inode, size_t first, size_t cnt,
+                 const uint8_t *src)
+{
+  bool ok;
+
+  ASSERT (lock_held_by_current_thread (&inode->lock));
+  inode->map_seq++;
+  barrier ();
+  ok = map_holes (&inode->data, first, cnt, src, &inode->dirty);
+  barrier ();
+  inode->map_seq++;
+  return ok;
+}
+
+/* Moves the data of inline DATA out into a sector of its own,
+   switching DATA to block pointers or, with -extents, to an extent
+   tree.  Returns false if the disk is full or memory runs out,
+   leaving DATA as it was.
+
+   The new mapping is built in a copy of DATA and installed only
+   once the data sector is written, pointers first and LAYOUT last.
+   A reader that finds DATA inline copies out of it under the
+   inode's lock, which the caller of an open inode holds, so no
+   reader ever sees the file without its data. */
+static bool
+inode_promote (struct inode_disk *data)
+{
+  struct inode_disk *new = malloc (sizeof *new);
+  uint8_t *buf = calloc (1, BLOCK_SECTOR_SIZE);
+  bool mapped = false;
+  bool success = false;
+
+  ASSERT (data->layout == INODE_INLINE);
+  if (new == NULL || buf == NULL)
+    goto done;
+  memcpy (buf, data->inline_data, INLINE_SIZE);
+
+  *new = *data;
+  memset (new->inline_data, 0, INLINE_SIZE);
+  new->layout = inode_use_extents ? INODE_EXTENTS : INODE_BLOCKS;
+  if (new->length > 0 && !map_holes (new, 0, 1, buf, &mapped))
+    goto done;
+
+  memcpy (data->inline_data, new->inline_data, INLINE_SIZE);
+  barrier ();
+  data->layout = new->layout;
+  success = true;
+
+ done:
+  free (new);
+  free (buf);
+  return success;
+}
+
+/* Grows DATA to LENGTH bytes, allocating zeroed sectors for its
+   new part.  Inline DATA stays inline if LENGTH still fits.
+   Returns false if LENGTH is too large or the disk is full. */
 bool
 inode_extend(struct inode_disk *data, off_t length)
 {
-	size_t cur = bytes_to_sectors(data->length);
-	size_t new = bytes_to_sectors(length);
-	
-  if (new < cur) {
-		return false;
-	} else if (new == cur) {
-		return true;
-	} else if (length > (DIRECT_SIZE + 128 + 128 * DIRECT_SIZE) * BLOCK_SECTOR_SIZE || length < data->length) {
-		return false;
-	}
-
-	static char buf[BLOCK_SECTOR_SIZE];
-
-
-	if (cur < DIRECT_SIZE) {
-		size_t s = new < DIRECT_SIZE ? new : DIRECT_SIZE;
-		for (int i = cur; i < s; i++) {
-				if (!free_map_allocate(1, &data->direct[i])) {
-					return false;
-				}
-				cache_write(data->direct[i], buf);
-			}
-			cur = DIRECT_SIZE;
-
-	}
-
-	if (cur < DIRECT_SIZE + 128 && new > DIRECT_SIZE) {
-		struct indirect_block *inode_indirect = calloc(1, sizeof(struct indirect_block));
-		cache_read(data->indirect, inode_indirect);
-		size_t s = new >= (DIRECT_SIZE + 128) ? 128 : (new - DIRECT_SIZE);
-
-		for (int i = cur - DIRECT_SIZE; i < s; i++) {
-				if (!free_map_allocate(1, &inode_indirect->block_ptrs[i])) {
-					return false;
-				}
-				cache_write(inode_indirect->block_ptrs[i], buf);
-			}
-			cur = DIRECT_SIZE + 128;
-		cache_write(data->indirect, inode_indirect);
-		free(inode_indirect);
-	}
-
-	if (cur < DIRECT_SIZE + 128 + 128 * 128 && new > DIRECT_SIZE + 128) {
-		off_t mini = (cur - DIRECT_SIZE + 128)/ 128;
-		off_t maxi = ((new - DIRECT_SIZE + 128) / 128) - 1;
-
-		struct indirect_block *doubly_indirect = calloc(1, sizeof(struct indirect_block));
-		cache_read(data->doubly_indirect, doubly_indirect);
-
-		if (!indirect_blocker(doubly_indirect, mini, maxi)) {
-			return false;
-		}
-
-		for (off_t i = mini; i <= maxi; i++) {
-			off_t min = 0;
-			off_t max = 128;
-
-			if (i == mini) {
-				min = (cur - DIRECT_SIZE + 128) % 128;
-			}
-			if (i == maxi) {
-				max = (new - DIRECT_SIZE + 128) % 128 - 1;
-			}
-			
-			struct indirect_block *indirect_block = calloc(1, sizeof(struct indirect_block));
-			cache_read(doubly_indirect->block_ptrs[i], indirect_block);
-			if (!indirect_blocker(indirect_block, min, max)) {
-				return false;
-			}
-			cache_write(doubly_indirect->block_ptrs[i], indirect_block);
-			free(indirect_block);
-		}
-		cache_write(data->doubly_indirect, doubly_indirect);
-		free(doubly_indirect);
-	}
-
-	data->length = length;
-	return true;
+  size_t cur = bytes_to_sectors(data->length);
+  size_t new = bytes_to_sectors(length);
+  bool mapped = false;
+
+  if (length < data->length)
+    return false;
+  if (data->layout == INODE_INLINE)
+    {
+      if (length <= (off_t) INLINE_SIZE)
+        {
+          data->length = length;
+          return true;
+        }
+      if (!inode_promote (data))
+        return false;
+    }
+  if (!length_fits (data, length))
+    return false;
+  if (new > cur && !map_holes (data, cur, new - cur, NULL, &mapped))
+    return false;
+
+  data->length = length;
+  return true;
 }
 
 /* Reads an inode from SECTOR
@@ -314,34 +988,44 @@ inode_extend(struct inode_disk *data, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct hash_elem *e;
   struct inode *inode;
 
+  lock_acquire (&open_inodes_lock);
+
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e))
+  lookup_key.sector = sector;
+  e = hash_find (&open_inodes, &lookup_key.elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector)
-        {
-          inode_reopen (inode);
-          return inode;
-        }
+      inode = hash_entry (e, struct inode, elem);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&open_inodes_lock);
+      return NULL;
+    }
 
-  /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
+  /* Initialize.  The inode is read before the lock is released so
+     that a concurrent opener never sees it half loaded. */
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  char buf[BLOCK_SECTOR_SIZE];
-  cache_read(inode->sector, &buf);
+  inode->read_next = 0;
+  inode->readahead_end = 0;
+  lock_init (&inode->lock);
+  inode->map_seq = 0;
+  inode->dirty = false;
+  cache_read (inode->sector, &inode->data);
+  hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
   return inode;
 }
 
@@ -350,7 +1034,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -361,6 +1049,67 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
+/* Writes INODE's resident inode_disk back to its sector in the
+   buffer cache if it has changed since it was last written.  Holds
+   INODE's lock meanwhile, so that a write in progress can't leave
+   a half-updated copy in the cache. */
+static void
+inode_write_back (struct inode *inode)
+{
+  lock_acquire (&inode->lock);
+  if (inode->dirty)
+    {
+      cache_write (inode->sector, &inode->data);
+      inode->dirty = false;
+    }
+  lock_release (&inode->lock);
+}
+
+/* Writes every open inode whose inode_disk has changed back to
+   the buffer cache, so that a following cache_flush() makes them
+   durable.  The write-behind thread calls this before each pass,
+   so the length and block pointers of a file that stays open
+   reach the disk along with its data.
+
+   The dirty inodes are collected, each with a reference of its own,
+   under the open inode table lock, but written back after it is
+   released, so that opens and closes don't wait behind a large
+   write that holds one of them. */
+void
+inode_flush (void)
+{
+  struct hash_iterator i;
+  struct inode **dirty;
+  size_t dirty_cnt = 0;
+  size_t j;
+
+  lock_acquire (&open_inodes_lock);
+  dirty = malloc (hash_size (&open_inodes) * sizeof *dirty);
+  if (dirty == NULL)
+    {
+      lock_release (&open_inodes_lock);
+      return;
+    }
+  hash_first (&i, &open_inodes);
+  while (hash_next (&i))
+    {
+      struct inode *inode = hash_entry (hash_cur (&i), struct inode, elem);
+      if (inode->dirty && !inode->removed)
+        {
+          inode->open_cnt++;
+          dirty[dirty_cnt++] = inode;
+        }
+    }
+  lock_release (&open_inodes_lock);
+
+  for (j = 0; j < dirty_cnt; j++)
+    {
+      inode_write_back (dirty[j]);
+      inode_close (dirty[j]);
+    }
+  free (dirty);
+}
+
 /* Closes INODE and writes it to disk.
    If this was the last reference to INODE, frees its memory.
    If INODE was also a removed inode, frees its blocks. */
@@ -371,21 +1120,38 @@ inode_close (struct inode *inode)
   if (inode == NULL)
     return;
 
+  /* If this is the last opener, write the inode back while it is
+     still in the open inode table, so that a reopen can't read a
+     stale copy.  The write happens outside the table lock, so
+     recheck afterward: someone may have reopened, changed and
+     closed the inode meanwhile. */
+  lock_acquire (&open_inodes_lock);
+  while (inode->open_cnt == 1 && !inode->removed && inode->dirty)
+    {
+      lock_release (&open_inodes_lock);
+      inode_write_back (inode);
+      lock_acquire (&open_inodes_lock);
+    }
+
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  if (--inode->open_cnt > 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
+      lock_release (&open_inodes_lock);
+      return;
+    }
 
-      /* Deallocate blocks if removed. */
-      if (inode->removed)
-        {
-          free_map_release (inode->sector, 1);
-		      inode_dealloc(inode);
-        }
+  /* Remove from the open inode table and release lock. */
+  hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
 
-      free (inode);
+  /* Deallocate blocks if removed. */
+  if (inode->removed)
+    {
+      free_map_release (inode->sector, 1);
+      inode_dealloc(inode);
     }
+
+  free (inode);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -397,6 +1163,62 @@ inode_remove (struct inode *inode)
   inode->removed = true;
 }
 
+/* If a read ending at OFFSET continued a sequential scan of
+   INODE, queues the next cache_readahead_window sectors of INODE
+   for read-ahead, skipping any that were queued before. */
+static void
+inode_readahead (struct inode *inode, off_t start, off_t offset)
+{
+  bool sequential = start == inode->read_next;
+  inode->read_next = offset;
+  if (!sequential)
+    inode->readahead_end = 0;
+  if (!sequential || cache_readahead_window == 0
+      || inode->data.layout == INODE_INLINE)
+    return;
+
+  off_t length = inode_length (inode);
+  off_t pos = ROUND_UP (offset, BLOCK_SECTOR_SIZE);
+  off_t end = pos + (off_t) cache_readahead_window * BLOCK_SECTOR_SIZE;
+  if (pos < inode->readahead_end)
+    pos = inode->readahead_end;
+
+  for (; pos < end && pos < length; pos += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, pos);
+      if (sector != 0)
+        cache_readahead (sector);
+    }
+  if (pos > inode->readahead_end)
+    inode->readahead_end = pos;
+}
+
+/* Returns the number of whole sectors of INODE, starting with
+   SECTOR at byte OFFSET and spanning at most SIZE bytes, that lie
+   at consecutive sector numbers on disk.  Returns at least 1.
+   Sectors past end of file count too, for a write that extends
+   the file. */
+static size_t
+contiguous_sectors (struct inode *inode, block_sector_t sector,
+                    off_t offset, off_t size)
+{
+  size_t cnt = 1;
+
+  if (inode->data.layout == INODE_EXTENTS)
+    {
+      /* The extent holding SECTOR says how far the run goes. */
+      size_t max = size / BLOCK_SECTOR_SIZE;
+      inode_lookup (inode, offset / BLOCK_SECTOR_SIZE, &cnt);
+      return cnt < max ? cnt : max;
+    }
+
+  while ((off_t) (cnt + 1) * BLOCK_SECTOR_SIZE <= size
+         && inode_lookup (inode, offset / BLOCK_SECTOR_SIZE + cnt, NULL)
+            == sector + cnt)
+    cnt++;
+  return cnt;
+}
+
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
    Returns the number of bytes actually read, which may be less
    than SIZE if an error occurs or end of file is reached. */
@@ -405,7 +1227,26 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
+  off_t start = offset;
+
+  if (inode->data.layout == INODE_INLINE)
+    {
+      /* Copy straight out of the inode, unless a writer promoted
+         it while we waited for the lock. */
+      lock_acquire (&inode->lock);
+      if (inode->data.layout == INODE_INLINE)
+        {
+          if (size > inode_length (inode) - offset)
+            size = inode_length (inode) - offset;
+          if (size <= 0 || offset < 0)
+            size = 0;
+          else
+            memcpy (buffer, inode->data.inline_data + offset, size);
+          lock_release (&inode->lock);
+          return size;
+        }
+      lock_release (&inode->lock);
+    }
 
   while (size > 0)
     {
@@ -423,25 +1264,28 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if (sector_idx == 0)
         {
-          /* Read full sector directly into caller's buffer. */
-          //block_read (fs_device, sector_idx, buffer + bytes_read);
-          cache_read(sector_idx, buffer + bytes_read);
+          /* A hole reads as zeros. */
+          memset (buffer + bytes_read, 0, chunk_size);
+        }
+      else if (chunk_size == BLOCK_SECTOR_SIZE)
+        {
+          /* Whole sectors: extend the chunk over any following
+             sectors that are contiguous on disk and read them all
+             with one request. */
+          size_t cnt = contiguous_sectors (inode, sector_idx, offset,
+                                           size < inode_left
+                                           ? size : inode_left);
+          cache_read_range (sector_idx, cnt, buffer + bytes_read);
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
         }
       else
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL)
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          //block_read (fs_device, sector_idx, bounce);
-          cache_read(sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          /* Copy straight out of the cached sector into caller's
+             buffer. */
+          cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                         chunk_size);
         }
 
       /* Advance. */
@@ -449,92 +1293,145 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  inode_readahead (inode, start, offset);
 
   return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET,
+   growing INODE if the write ends past end of file.  Sectors are
+   allocated only for holes that the write covers, so writing past
+   end of file leaves a hole behind it.  INODE's length covers only
+   the bytes actually written.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the file would grow too large or the disk is
+   full. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset)
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
 
-  if (inode->deny_write_cnt)
+  if (inode->deny_write_cnt || size <= 0 || offset < 0)
     return 0;
 
-  char buf[BLOCK_SECTOR_SIZE];
-  cache_read(inode->sector, &buf);
-  struct inode_disk *data = (struct inode_disk*) buf;
+  lock_acquire (&inode->lock);
+  if (inode->data.layout == INODE_INLINE)
+    {
+      if (offset + size <= (off_t) INLINE_SIZE)
+        {
+          /* Copy straight into the inode. */
+          memcpy (inode->data.inline_data + offset, buffer, size);
+          if (offset + size > inode->data.length)
+            inode->data.length = offset + size;
+          inode->dirty = true;
+          lock_release (&inode->lock);
+          return size;
+        }
 
-  if (byte_to_sector(inode, offset + size - 1) == -1) {
-    if (!inode_extend(data, offset + size)) {
-      return 0;
+      /* Too big to stay inline. */
+      if (!inode_promote (&inode->data))
+        {
+          lock_release (&inode->lock);
+          return 0;
+        }
+      inode->dirty = true;
     }
 
-    data->length = offset + size;
-    cache_write(inode->sector, data);
-  }
+  if (!length_fits (&inode->data, offset + size))
+    {
+      lock_release (&inode->lock);
+      return 0;
+    }
+  lock_release (&inode->lock);
 
   while (size > 0)
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      size_t idx = offset / BLOCK_SECTOR_SIZE;
+      block_sector_t sector_idx = inode_lookup (inode, idx, NULL);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Number of bytes to actually write into this sector. */
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
-      int min_left = inode_left < sector_left ? inode_left : sector_left;
+      int chunk_size = size < sector_left ? size : sector_left;
 
-      /* Number of bytes to actually write into this sector. */
-      int chunk_size = size < min_left ? size : min_left;
-      if (chunk_size <= 0)
-        break;
+      /* Holes filled with this write's data, up to a batch. */
+      size_t filled = 0;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Write full sector directly to disk. */
-          //block_write(fs_device, sector_idx, buffer + bytes_written);
-          cache_write(sector_idx, buffer + bytes_written);
-        }
-      else
+      if (sector_idx == 0)
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL)
+          /* Allocate this hole.  For whole sectors, also allocate
+             the holes right after it within the write, and have
+             map_holes() write the data into them before they are
+             mapped.  A sector that the write covers partly is
+             zeroed instead, and written below.  Either way, no
+             reader sees what the new sectors held before.  The
+             holes are found under the lock, since another writer
+             may be filling them. */
+          bool ok = true;
+
+          lock_acquire (&inode->lock);
+          if (chunk_size == BLOCK_SECTOR_SIZE)
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              size_t max = (size / BLOCK_SECTOR_SIZE < EXTEND_BATCH
+                            ? size / BLOCK_SECTOR_SIZE : EXTEND_BATCH);
+
+              while (filled < max
+                     && sector_lookup (&inode->data, idx + filled) == 0)
+                filled++;
+              if (filled > 0)
+                ok = inode_map_holes (inode, idx, filled,
+                                      buffer + bytes_written);
             }
+          else if (sector_lookup (&inode->data, idx) == 0)
+            ok = inode_map_holes (inode, idx, 1, NULL);
+          lock_release (&inode->lock);
+          if (!ok)
+            break;
+          sector_idx = inode_lookup (inode, idx, NULL);
+        }
 
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) {
-            //block_read (fs_device, sector_idx, bounce);
-        	cache_read(sector_idx, bounce);
-          } else {
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          }
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          //block_write (fs_device, sector_idx, bounce);
-          cache_write(sector_idx, bounce);
+      if (filled > 0)
+        {
+          /* Already written by map_holes(). */
+          chunk_size = filled * BLOCK_SECTOR_SIZE;
+        }
+      else if (chunk_size == BLOCK_SECTOR_SIZE)
+        {
+          /* Whole sectors, none of which need to be read first. */
+          size_t cnt = contiguous_sectors (inode, sector_idx, offset, size);
+          cache_write_range (sector_idx, cnt, buffer + bytes_written);
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
+        }
+      else
+        {
+          /* Copy straight into the cached sector.  The cache reads
+             in the rest of the sector first if the chunk doesn't
+             cover it. */
+          cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                          chunk_size);
         }
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
+
+      /* Grow the file over what has been written so far, so that a
+         write cut short by a full disk leaves no unwritten tail. */
+      if (offset > inode_length (inode))
+        {
+          lock_acquire (&inode->lock);
+          if (offset > inode->data.length)
+            {
+              inode->data.length = offset;
+              inode->dirty = true;
+            }
+          lock_release (&inode->lock);
+        }
     }
-  free (bounce);
 
   return bytes_written;
 }
@@ -563,26 +1460,17 @@ inode_allow_write (struct inode *inode)
 off_t
 inode_length (const struct inode *inode)
 {
-  char buf[BLOCK_SECTOR_SIZE];
-  cache_read(inode->sector, &buf);
-  struct inode_disk *data = (struct inode_disk*) buf;
-  return data->length;
+  return inode->data.length;
 }
 
 bool
-inode_isdir(struct inode *inode) {
-  char buf[BLOCK_SECTOR_SIZE];
-  cache_read(inode->sector, &buf);
-  struct inode_disk *data = (struct inode_disk*) buf;
-  return data->directory;
+inode_isdir(const struct inode *inode) {
+  return inode->data.directory;
 }
 
 block_sector_t
 inode_get_parent(struct inode *inode) {
-  char buf[BLOCK_SECTOR_SIZE];
-  cache_read(inode->sector, &buf);
-  struct inode_disk *data = (struct inode_disk*) buf;
-  return data->parent_node;
+  return inode->data.parent_node;
 }
 
 bool
@@ -0,0 +1,57 @@
+#ifndef __LIB_BLOCK_LATENCY_H
+#define __LIB_BLOCK_LATENCY_H
+
+/* Number of buckets in a latency histogram.  Bucket 0 counts
+   requests that took less than 2 microseconds and bucket I > 0
+   those that took from 2**I up to 2**(I+1) microseconds.  The
+   last bucket also counts anything slower. */
+#define BLOCK_LATENCY_BUCKETS 24
+
+/* Operations with a histogram each. */
+#define BLOCK_LATENCY_READ 0
+#define BLOCK_LATENCY_WRITE 1
+
+/* Request latency histograms for a block device, as reported by
+   the kernel at shutdown and to user programs by the blkstat
+   system call.  Latency runs from submission to completion, so it
+   includes time spent waiting in the device's queue. */
+struct block_latency
+  {
+    unsigned long long buckets[2][BLOCK_LATENCY_BUCKETS];
+    unsigned long long total_us[2];     /* Sum of all latencies. */
+  };
+
+/* Returns the total number of OP requests in L. */
+static inline unsigned long long
+block_latency_count (const struct block_latency *l, int op)
+{
+  unsigned long long cnt = 0;
+  int i;
+
+  for (i = 0; i < BLOCK_LATENCY_BUCKETS; i++)
+    cnt += l->buckets[op][i];
+  return cnt;
+}
+
+/* Returns an upper bound, in microseconds, on the PCT'th
+   percentile latency of OP requests in L, or 0 if there were
+   none. */
+static inline unsigned long long
+block_latency_percentile (const struct block_latency *l, int op, int pct)
+{
+  unsigned long long cnt = block_latency_count (l, op);
+  unsigned long long seen = 0;
+  int i;
+
+  if (cnt == 0)
+    return 0;
+  for (i = 0; i < BLOCK_LATENCY_BUCKETS - 1; i++)
+    {
+      seen += l->buckets[op][i];
+      if (seen * 100 >= cnt * pct)
+        break;
+    }
+  return 2ULL << i;
+}
+
+#endif /* lib/block-latency.h */
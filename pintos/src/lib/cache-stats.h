@@ -0,0 +1,18 @@
+#ifndef __LIB_CACHE_STATS_H
+#define __LIB_CACHE_STATS_H
+
+/* Buffer cache statistics, as reported by the kernel at shutdown
+   and to user programs by the cachestat system call. */
+struct cache_stats
+  {
+    unsigned long long hits;            /* Lookups found in the cache. */
+    unsigned long long misses;          /* Lookups that had to load. */
+    unsigned long long evictions;       /* Entries reused for a new sector. */
+    unsigned long long writebacks;      /* Dirty entries written to disk. */
+    unsigned long long readahead_hits;  /* Prefetched, then used. */
+    unsigned long long readahead_wasted; /* Prefetched, never used. */
+    unsigned long long lock_waits;      /* Contended cache lock acquires. */
+    unsigned long long lock_wait_usecs; /* Microseconds spent waiting. */
+  };
+
+#endif /* lib/cache-stats.h */
@@ -29,7 +29,9 @@ enum
     SYS_MKDIR,                  /* Create a directory. */
     SYS_READDIR,                /* Reads a directory entry. */
     SYS_ISDIR,                  /* Tests if a fd represents a directory. */
-    SYS_INUMBER                 /* Returns the inode number for a fd. */
+    SYS_INUMBER,                /* Returns the inode number for a fd. */
+    SYS_CACHESTAT,              /* Reports buffer cache statistics. */
+    SYS_BLKSTAT                 /* Reports block device latencies. */
   };
 
 #endif /* lib/syscall-nr.h */
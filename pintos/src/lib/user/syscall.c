@@ -191,6 +191,18 @@ inumber (int fd)
   return syscall1 (SYS_INUMBER, fd);
 }
 
+bool
+cachestat (struct cache_stats *stats)
+{
+  return syscall1 (SYS_CACHESTAT, stats);
+}
+
+bool
+blkstat (const char *device, struct block_latency *latency)
+{
+  return syscall2 (SYS_BLKSTAT, device, latency);
+}
+
 void*
 sbrk (intptr_t increment)
 {
@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <debug.h>
+#include <block-latency.h>
+#include <cache-stats.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -46,6 +48,8 @@ bool mkdir (const char *dir);
 bool readdir (int fd, char name[READDIR_MAX_LEN + 1]);
 bool isdir (int fd);
 int inumber (int fd);
+bool cachestat (struct cache_stats *);
+bool blkstat (const char *device, struct block_latency *);
 
 /* Homework 5, Part B. */
 void* sbrk (intptr_t increment);
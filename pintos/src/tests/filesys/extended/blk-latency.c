@@ -0,0 +1,50 @@
+/* Checks that the blkstat system call counts the requests of a
+   read that misses the buffer cache, and fails for a device that
+   does not exist. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+/* Many times the default cache size, so that reading the file
+   back from the beginning must go to the disk. */
+#define FILE_SIZE (256 * 1024)
+#define CHUNK_SIZE 4096
+static char buf[CHUNK_SIZE];
+
+void
+test_main (void)
+{
+  struct block_latency before, after;
+  size_t ofs;
+  int fd;
+
+  CHECK (create ("lat", 0), "create \"lat\"");
+  CHECK ((fd = open ("lat")) > 1, "open \"lat\"");
+  msg ("write \"lat\"");
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    if (write (fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+      fail ("write \"lat\" failed at offset %zu", ofs);
+
+  CHECK (blkstat (NULL, &before), "blkstat");
+  msg ("read \"lat\"");
+  seek (fd, 0);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += CHUNK_SIZE)
+    if (read (fd, buf, CHUNK_SIZE) != CHUNK_SIZE)
+      fail ("read \"lat\" failed at offset %zu", ofs);
+  CHECK (blkstat (NULL, &after), "blkstat");
+
+  /* Even merged into the largest ranges the cache reads, the
+     sectors that missed take several requests. */
+  CHECK (block_latency_count (&after, BLOCK_LATENCY_READ)
+         >= block_latency_count (&before, BLOCK_LATENCY_READ) + 3,
+         "read adds to the read latency count");
+  CHECK (after.total_us[BLOCK_LATENCY_READ]
+         > before.total_us[BLOCK_LATENCY_READ],
+         "read adds to the total read latency");
+
+  msg ("close \"lat\"");
+  close (fd);
+  CHECK (remove ("lat"), "remove \"lat\"");
+  CHECK (!blkstat ("nosuchdev", &before), "blkstat of unknown device fails");
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(blk-latency) begin
+(blk-latency) create "lat"
+(blk-latency) open "lat"
+(blk-latency) write "lat"
+(blk-latency) blkstat
+(blk-latency) read "lat"
+(blk-latency) blkstat
+(blk-latency) read adds to the read latency count
+(blk-latency) read adds to the total read latency
+(blk-latency) close "lat"
+(blk-latency) remove "lat"
+(blk-latency) blkstat of unknown device fails
+(blk-latency) end
+EOF
+pass;
@@ -0,0 +1,48 @@
+/* Reads a file twice and checks that the second read is served
+   from the buffer cache, using the cachestat system call. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE 8192
+static char buf[FILE_SIZE];
+
+/* Reads all of the file open as FD into buf, starting over from
+   the beginning. */
+static void
+read_all (int fd)
+{
+  seek (fd, 0);
+  if (read (fd, buf, FILE_SIZE) != FILE_SIZE)
+    fail ("read of \"cache\" failed");
+}
+
+void
+test_main (void)
+{
+  struct cache_stats before, after;
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create ("cache", 0), "create \"cache\"");
+  CHECK ((fd = open ("cache")) > 1, "open \"cache\"");
+  CHECK (write (fd, buf, FILE_SIZE) == FILE_SIZE, "write \"cache\"");
+
+  msg ("read \"cache\"");
+  read_all (fd);
+  CHECK (cachestat (&before), "cachestat");
+
+  msg ("read \"cache\" again");
+  read_all (fd);
+  CHECK (cachestat (&after), "cachestat");
+
+  CHECK (after.hits - before.hits > after.misses - before.misses,
+         "second read mostly hits the cache");
+
+  msg ("close \"cache\"");
+  close (fd);
+}
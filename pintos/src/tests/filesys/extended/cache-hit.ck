@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cache-hit) begin
+(cache-hit) create "cache"
+(cache-hit) open "cache"
+(cache-hit) write "cache"
+(cache-hit) read "cache"
+(cache-hit) cachestat
+(cache-hit) read "cache" again
+(cache-hit) cachestat
+(cache-hit) second read mostly hits the cache
+(cache-hit) close "cache"
+(cache-hit) end
+EOF
+pass;
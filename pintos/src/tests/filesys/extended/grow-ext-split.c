@@ -0,0 +1,75 @@
+/* Grows two files alternately, one sector at a time, so that no
+   two consecutive sectors of either file are adjacent on disk and
+   each sector needs an extent of its own.  Run with -extents, that
+   overflows the extent root, which is pushed down into a node of
+   its own, and then splits leaf nodes.  Then removes one file,
+   releasing its extent tree, and grows a third in its place. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SECTOR_SIZE 512
+#define FILE_SIZE (200 * SECTOR_SIZE)
+static char buf_a[FILE_SIZE];
+static char buf_b[FILE_SIZE];
+static char buf_c[FILE_SIZE];
+
+/* Appends the sector at offset OFS in BUF to FILE_NAME, open as
+   FD. */
+static void
+write_sector (const char *file_name, int fd, const char *buf, size_t ofs)
+{
+  int ret_val = write (fd, buf + ofs, SECTOR_SIZE);
+  if (ret_val != SECTOR_SIZE)
+    fail ("write %d bytes at offset %zu in \"%s\" returned %d",
+          SECTOR_SIZE, ofs, file_name, ret_val);
+}
+
+void
+test_main (void)
+{
+  int fd_a, fd_b, fd_c;
+  size_t ofs;
+
+  random_init (0);
+  random_bytes (buf_a, sizeof buf_a);
+  random_bytes (buf_b, sizeof buf_b);
+  random_bytes (buf_c, sizeof buf_c);
+
+  CHECK (create ("a", 0), "create \"a\"");
+  CHECK (create ("b", 0), "create \"b\"");
+
+  CHECK ((fd_a = open ("a")) > 1, "open \"a\"");
+  CHECK ((fd_b = open ("b")) > 1, "open \"b\"");
+
+  msg ("write \"a\" and \"b\" alternately, a sector at a time");
+  for (ofs = 0; ofs < FILE_SIZE; ofs += SECTOR_SIZE)
+    {
+      write_sector ("a", fd_a, buf_a, ofs);
+      write_sector ("b", fd_b, buf_b, ofs);
+    }
+
+  msg ("close \"a\"");
+  close (fd_a);
+
+  msg ("close \"b\"");
+  close (fd_b);
+
+  check_file ("a", buf_a, FILE_SIZE);
+  check_file ("b", buf_b, FILE_SIZE);
+
+  CHECK (remove ("a"), "remove \"a\"");
+
+  CHECK (create ("c", 0), "create \"c\"");
+  CHECK ((fd_c = open ("c")) > 1, "open \"c\"");
+  msg ("write \"c\" a sector at a time");
+  for (ofs = 0; ofs < FILE_SIZE; ofs += SECTOR_SIZE)
+    write_sector ("c", fd_c, buf_c, ofs);
+  msg ("close \"c\"");
+  close (fd_c);
+
+  check_file ("b", buf_b, FILE_SIZE);
+  check_file ("c", buf_c, FILE_SIZE);
+}
@@ -0,0 +1,33 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-ext-split) begin
+(grow-ext-split) create "a"
+(grow-ext-split) create "b"
+(grow-ext-split) open "a"
+(grow-ext-split) open "b"
+(grow-ext-split) write "a" and "b" alternately, a sector at a time
+(grow-ext-split) close "a"
+(grow-ext-split) close "b"
+(grow-ext-split) open "a" for verification
+(grow-ext-split) verified contents of "a"
+(grow-ext-split) close "a"
+(grow-ext-split) open "b" for verification
+(grow-ext-split) verified contents of "b"
+(grow-ext-split) close "b"
+(grow-ext-split) remove "a"
+(grow-ext-split) create "c"
+(grow-ext-split) open "c"
+(grow-ext-split) write "c" a sector at a time
+(grow-ext-split) close "c"
+(grow-ext-split) open "b" for verification
+(grow-ext-split) verified contents of "b"
+(grow-ext-split) close "b"
+(grow-ext-split) open "c" for verification
+(grow-ext-split) verified contents of "c"
+(grow-ext-split) close "c"
+(grow-ext-split) end
+EOF
+pass;
@@ -0,0 +1,42 @@
+/* Writes data at the start of a file, then seeks well past its end
+   and writes more, and checks that the hole left between the two
+   reads back as zeros. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define HEAD_SIZE 1000
+#define HOLE_SIZE 30000
+#define TAIL_SIZE 1000
+#define FILE_SIZE (HEAD_SIZE + HOLE_SIZE + TAIL_SIZE)
+static char buf[FILE_SIZE];
+
+void
+test_main (void)
+{
+  const char *file_name = "testfile";
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, HEAD_SIZE);
+  random_bytes (buf + HEAD_SIZE + HOLE_SIZE, TAIL_SIZE);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, HEAD_SIZE) == HEAD_SIZE,
+         "write %d bytes to \"%s\"", HEAD_SIZE, file_name);
+  msg ("seek \"%s\" past end of file", file_name);
+  seek (fd, HEAD_SIZE + HOLE_SIZE);
+  CHECK (write (fd, buf + HEAD_SIZE + HOLE_SIZE, TAIL_SIZE) == TAIL_SIZE,
+         "write %d bytes to \"%s\"", TAIL_SIZE, file_name);
+
+  msg ("check \"%s\" while open", file_name);
+  seek (fd, 0);
+  check_file_handle (fd, file_name, buf, FILE_SIZE);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  check_file (file_name, buf, FILE_SIZE);
+}
@@ -0,0 +1,21 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-inline-ext) begin
+(grow-inline-ext) create "testfile"
+(grow-inline-ext) open "testfile"
+(grow-inline-ext) write 300 bytes to "testfile"
+(grow-inline-ext) check "testfile" while open
+(grow-inline-ext) verified contents of "testfile"
+(grow-inline-ext) write 300 bytes to "testfile"
+(grow-inline-ext) check "testfile" while open
+(grow-inline-ext) verified contents of "testfile"
+(grow-inline-ext) close "testfile"
+(grow-inline-ext) open "testfile" for verification
+(grow-inline-ext) verified contents of "testfile"
+(grow-inline-ext) close "testfile"
+(grow-inline-ext) end
+EOF
+pass;
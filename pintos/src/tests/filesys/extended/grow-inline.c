@@ -0,0 +1,41 @@
+/* Grows a file that starts out small enough to be stored in its
+   inode, 496 bytes, past that limit, checking its contents before
+   and after. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FIRST_SIZE 300
+#define FILE_SIZE 600
+static char buf[FILE_SIZE];
+
+void
+test_main (void)
+{
+  const char *file_name = "testfile";
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  CHECK (write (fd, buf, FIRST_SIZE) == FIRST_SIZE,
+         "write %d bytes to \"%s\"", FIRST_SIZE, file_name);
+  msg ("check \"%s\" while open", file_name);
+  seek (fd, 0);
+  check_file_handle (fd, file_name, buf, FIRST_SIZE);
+
+  CHECK (write (fd, buf + FIRST_SIZE, FILE_SIZE - FIRST_SIZE)
+         == FILE_SIZE - FIRST_SIZE,
+         "write %d bytes to \"%s\"", FILE_SIZE - FIRST_SIZE, file_name);
+  msg ("check \"%s\" while open", file_name);
+  seek (fd, 0);
+  check_file_handle (fd, file_name, buf, FILE_SIZE);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  check_file (file_name, buf, FILE_SIZE);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-seq-lg-ext) begin
+(grow-seq-lg-ext) create "testme"
+(grow-seq-lg-ext) open "testme"
+(grow-seq-lg-ext) writing "testme"
+(grow-seq-lg-ext) close "testme"
+(grow-seq-lg-ext) open "testme" for verification
+(grow-seq-lg-ext) verified contents of "testme"
+(grow-seq-lg-ext) close "testme"
+(grow-seq-lg-ext) end
+EOF
+pass;
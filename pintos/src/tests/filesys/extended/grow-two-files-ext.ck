@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+use tests::random;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(grow-two-files-ext) begin
+(grow-two-files-ext) create "a"
+(grow-two-files-ext) create "b"
+(grow-two-files-ext) open "a"
+(grow-two-files-ext) open "b"
+(grow-two-files-ext) write "a" and "b" alternately
+(grow-two-files-ext) close "a"
+(grow-two-files-ext) close "b"
+(grow-two-files-ext) open "a" for verification
+(grow-two-files-ext) verified contents of "a"
+(grow-two-files-ext) close "a"
+(grow-two-files-ext) open "b" for verification
+(grow-two-files-ext) verified contents of "b"
+(grow-two-files-ext) close "b"
+(grow-two-files-ext) end
+EOF
+pass;
@@ -34,9 +34,12 @@
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/stripe.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #include "filesys/cache.h"
+#include "filesys/inode.h"
 #endif
 
 /* Page directory with kernel mappings only. */
@@ -124,8 +127,12 @@ main (void)
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  ramdisk_init ();
+  stripe_init ();
   cache_init();
   locate_block_devices ();
+  if (ramdisk_preload)
+    ramdisk_load (block_get_role (BLOCK_SCRATCH));
   filesys_init (format_filesys);
 #endif
 
@@ -249,6 +256,38 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_kb = atoi (value);
+      else if (!strcmp (name, "-ramdisk-load"))
+        ramdisk_preload = true;
+      else if (!strcmp (name, "-stripe"))
+        {
+          if (!stripe_configure (value))
+            PANIC ("bad stripe set `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-dma"))
+        ide_use_dma = true;
+      else if (!strcmp (name, "-iosched"))
+        {
+          if (!block_configure_schedulers (value))
+            PANIC ("bad I/O scheduler `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-extents"))
+        inode_use_extents = true;
+      else if (!strcmp (name, "-flush"))
+        cache_flush_msecs = atoi (value);
+      else if (!strcmp (name, "-ra"))
+        cache_readahead_window = atoi (value);
+      else if (!strcmp (name, "-cache"))
+        {
+          if (!cache_set_size (value))
+            PANIC ("bad cache size `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-cache-policy"))
+        {
+          if (!cache_set_policy (value))
+            PANIC ("unknown cache policy `%s' (use -h for help)", value);
+        }
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -375,6 +414,23 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -ramdisk=KB        Create a KB kB RAM disk named ram0, for use\n"
+          "                     with e.g. -filesys=ram0 or -swap=ram0.\n"
+          "  -ramdisk-load      Copy the scratch device into ram0 at boot.\n"
+          "  -stripe=DEV,DEV[,...][:CHUNK]  Create md0, striped over the\n"
+          "                     DEVs in CHUNK-sector chunks (default 8).\n"
+          "  -dma               Use bus-master DMA for IDE disk transfers.\n"
+          "  -iosched=[DEV:]SCHED,...  Use SCHED (noop, clook or deadline)\n"
+          "                     to order I/O on DEV, or on all devices.\n"
+          "                     DEV may be an IDE channel's queue, ide0\n"
+          "                     (hda, hdb) or ide1 (hdc, hdd); naming a\n"
+          "                     disk or partition sets its channel's.\n"
+          "  -extents           Map newly created files with extent trees.\n"
+          "  -flush=MSECS       Write back dirty cache blocks every MSECS ms.\n"
+          "  -ra=SECTORS        Read ahead SECTORS sectors on sequential reads.\n"
+          "  -cache=SECTORS     Cache SECTORS sectors of file system data.\n"
+          "  -cache=PCT%%       Give PCT%% of the kernel page pool to the cache.\n"
+          "  -cache-policy=POL  Use POL (2q or clock) for cache replacement.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
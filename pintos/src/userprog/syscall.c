@@ -10,9 +10,11 @@
 #include "filesys/filesys.h"
 #include "filesys/file.h"
 #include "filesys/inode.h"
+#include "devices/block.h"
 #include "devices/shutdown.h"
 #include "userprog/process.h"
 #include "filesys/directory.h"
+#include "filesys/cache.h"
 #include "userprog/pagedir.h"
 #include "devices/input.h"
 
@@ -239,4 +241,16 @@ syscall_handler (struct intr_frame *f)
     struct file_info *fi = fd_to_file(args[1]);
     f->eax = fi->dir != NULL;   
   }
+  if (args[0] == SYS_CACHESTAT) {
+    valid_ptr((void *)args[1], sizeof (struct cache_stats));
+    cache_get_stats ((struct cache_stats *) args[1]);
+    f->eax = true;
+  }
+  if (args[0] == SYS_BLKSTAT) {
+    if ((char *) args[1] != NULL)
+      valid_ptr((void *)args[1], sizeof(char *));
+    valid_ptr((void *)args[2], sizeof (struct block_latency));
+    f->eax = block_get_latency ((char *) args[1],
+                                (struct block_latency *) args[2]);
+  }
 }